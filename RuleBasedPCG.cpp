@@ -1,39 +1,4968 @@
 #include <iostream>
 #include <vector>
+#include <array>
+#include <algorithm> // For std::min / std::max
+#include <cstdint>  // For fixed-width cell types
 #include <random>   // For random number generation
-#include <chrono>   // For seeding the random number generator
+#include <chrono>   // For clock seeding and timing
+#include <thread>   // For the worker threads of ThreadPool
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <type_traits>
+#include <limits>     // For std::numeric_limits
+#include <cmath>      // For std::sqrt (ellipse rooms)
+#include <string>
+#include <stdexcept>  // For std::invalid_argument
+#include <map>        // For command line options
+#include <sstream>    // For digit maps in the batch pipeline and cache file names
+#include <list>       // For the chunk LRU of ChunkedWorld
+#include <unordered_map>
+#include <fstream>    // For writing generated maps
+#include <iterator>   // For reading MapCache key files
+#include <filesystem> // For creating the output directory
+#include <memory>
+#include <optional>
+#include <new>        // For the allocation counter
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>   // For write(2) and getpid(2)
+#include <fcntl.h>    // For open(2)
+#include <sys/mman.h> // For mmap(2) of binary map files
+#include <sys/stat.h>
 
-// Define Map as a vector of vectors of integers.
-// You can change 'int' to whatever type best represents your cells (e.g., char, bool).
-using Map = std::vector<std::vector<int>>;
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> // AVX2 intrinsics (selected at runtime)
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__CUDACC__)
+#include <cuda_runtime.h> // GPU backend (only when compiled with nvcc -x cu)
+#define PCG_CUDA 1
+#define PCG_CUDA_LAUNCH(kernel, grid, block, shared, ...) kernel<<<grid, block, shared>>>(__VA_ARGS__)
+#elif defined(PCG_CUDA_HOST_CHECK)
+// Comprobacion de compilacion del backend GPU sin nvcc (g++ -DPCG_CUDA_HOST_CHECK): declara lo
+// minimo de la API de CUDA para que el host compile CudaGrid y los kernels. No hay dispositivo
+// (cudaGetDeviceCount falla), asi que --backend=gpu sigue usando la CPU.
+#define PCG_CUDA 1
+#define __global__
+#define __shared__
+enum cudaError_t { cudaSuccess = 0, cudaErrorNoDevice = 100 };
+enum cudaMemcpyKind { cudaMemcpyHostToDevice = 1, cudaMemcpyDeviceToHost = 2 };
+struct dim3 {
+    unsigned x, y, z;
+    dim3(unsigned x_ = 1, unsigned y_ = 1, unsigned z_ = 1) : x(x_), y(y_), z(z_) {}
+};
+static dim3 threadIdx, blockIdx, blockDim;
+static unsigned char gpuShared[1];
+inline void __syncthreads() {}
+template <typename T>
+cudaError_t cudaMalloc(T** pointer, std::size_t) { *pointer = nullptr; return cudaErrorNoDevice; }
+inline cudaError_t cudaFree(void*) { return cudaSuccess; }
+inline cudaError_t cudaMemcpy(void*, const void*, std::size_t, cudaMemcpyKind) { return cudaErrorNoDevice; }
+inline cudaError_t cudaGetLastError() { return cudaErrorNoDevice; }
+inline cudaError_t cudaGetDeviceCount(int* count) { *count = 0; return cudaErrorNoDevice; }
+inline const char* cudaGetErrorString(cudaError_t) { return "no CUDA device (host check build)"; }
+#define PCG_CUDA_LAUNCH(kernel, grid, block, shared, ...) \
+    ((void)(grid), (void)(block), (void)(shared), kernel(__VA_ARGS__))
+#endif
+
+#if defined(PCG_BENCH_ALLOC)
+// Contador global de reservas de memoria dinamica (lo usa el modo bench para detectar reservas por
+// iteracion). Solo en builds de benchmark (-DPCG_BENCH_ALLOC): suma un incremento atomico a cada new.
+std::atomic<std::uint64_t> gAllocationCount{0};
+
+void* operator new(std::size_t size) {
+    gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+
+// Fuera de linea para que el compilador no empareje new/free al ver ambos lados
+__attribute__((noinline)) void releaseAllocation(void* p) noexcept { std::free(p); }
+void operator delete(void* p) noexcept { releaseAllocation(p); }
+void operator delete[](void* p) noexcept { releaseAllocation(p); }
+void operator delete(void* p, std::size_t) noexcept { releaseAllocation(p); }
+void operator delete[](void* p, std::size_t) noexcept { releaseAllocation(p); }
+#endif
+
+// Each cell occupies a single byte (0 = empty, 1 = occupied).
+using Cell = std::uint8_t;
+
+// Position of a cell: row i (agent X) and column j (agent Y).
+struct CellPos {
+    int row;
+    int col;
+};
+
+// Legacy nested representation, kept only for conversion to/from Map.
+using NestedMap = std::vector<std::vector<int>>;
+
+/**
+ * @brief Contiguous, row-major grid of cells.
+ * All rows live in a single allocation; row i starts at cells[origin + i * stride].
+ * The stride is rounded up so every row starts on a 32-byte boundary
+ * relative to the buffer, which keeps the inner loops cache friendly.
+ *
+ * A map may carry a border ring of pad cells on every side (see fillBorder):
+ * row(i)[j] is then valid for i in [-pad, height + pad) and j in [-pad, width + pad).
+ * The left border of a row lives at the end of the previous row's slot, so rows
+ * stay aligned; with pad == 0 (the default) the layout is the plain grid.
+ */
+struct Map {
+    int width = 0;   // Number of columns (W)
+    int height = 0;  // Number of rows (H)
+    int stride = 0;  // Distance, in cells, between the starts of two consecutive rows
+    int pad = 0;     // Width of the border ring around the visible cells
+    std::size_t origin = 0; // Offset of cell (0, 0) in cells
+    std::vector<Cell> cells;
+
+    Map() = default;
+
+    /**
+     * @brief Creates a map with the given number of rows and columns.
+     * @param rows Height of the map.
+     * @param cols Width of the map.
+     * @param value Initial value of every cell (border included).
+     * @param padding Width of the border ring.
+     */
+    Map(int rows, int cols, Cell value = 0, int padding = 0)
+        : width(cols), height(rows), stride(alignedStride(cols + 2 * padding)), pad(padding),
+          origin(static_cast<std::size_t>(padding + (padding > 0 ? 1 : 0)) * stride),
+          cells(static_cast<std::size_t>(rows + 2 * padding + (padding > 0 ? 1 : 0)) * stride, value) {}
+
+    Cell* row(int i) { return cells.data() + origin + static_cast<std::ptrdiff_t>(i) * stride; }
+    const Cell* row(int i) const { return cells.data() + origin + static_cast<std::ptrdiff_t>(i) * stride; }
+
+    Cell& operator()(int i, int j) { return row(i)[j]; }
+    Cell operator()(int i, int j) const { return row(i)[j]; }
+
+    bool inBounds(int i, int j) const { return i >= 0 && i < height && j >= 0 && j < width; }
+
+    // Two maps are equal when their visible cells match (stride padding is ignored).
+    bool operator==(const Map& other) const {
+        if (width != other.width || height != other.height) return false;
+        for (int i = 0; i < height; ++i) {
+            const Cell* a = row(i);
+            const Cell* b = other.row(i);
+            for (int j = 0; j < width; ++j) {
+                if (a[j] != b[j]) return false;
+            }
+        }
+        return true;
+    }
+    bool operator!=(const Map& other) const { return !(*this == other); }
+
+    static int alignedStride(int cols) { return (cols + 31) & ~31; }
+};
+
+/**
+ * @brief Copy of map with a border ring of pad cells (not filled; see fillBorder).
+ */
+Map withPadding(const Map& map, int pad) {
+    Map padded(map.height, map.width, 0, pad);
+    for (int i = 0; i < map.height; ++i) std::memcpy(padded.row(i), map.row(i), static_cast<std::size_t>(map.width));
+    return padded;
+}
+
+/**
+ * @brief Builds a flat Map from the legacy nested-vector representation.
+ * @param nested Rows of cells; all rows must have the same length.
+ * @return The equivalent contiguous map.
+ */
+Map fromNested(const NestedMap& nested) {
+    int rows = static_cast<int>(nested.size());
+    int cols = rows > 0 ? static_cast<int>(nested[0].size()) : 0;
+    Map map(rows, cols);
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) {
+            map(i, j) = static_cast<Cell>(nested[i][j]);
+        }
+    }
+    return map;
+}
+
+/**
+ * @brief Converts a flat Map back to the legacy nested-vector representation.
+ * @param map The map to convert.
+ * @return One std::vector<int> per row.
+ */
+NestedMap toNested(const Map& map) {
+    NestedMap nested(map.height, std::vector<int>(map.width));
+    for (int i = 0; i < map.height; ++i) {
+        const Cell* src = map.row(i);
+        for (int j = 0; j < map.width; ++j) {
+            nested[i][j] = src[j];
+        }
+    }
+    return nested;
+}
+
+/**
+ * @brief Prints the map (matrix) to the console.
+ * @param map The map to print.
+ * @param out Stream to print to (the console by default).
+ */
+void printMap(const Map& map, std::ostream& out = std::cout) {
+    out << "--- Current Map ---" << std::endl;
+    for (int i = 0; i < map.height; ++i) {
+        const Cell* row = map.row(i);
+        for (int j = 0; j < map.width; ++j) {
+            // Adapt this to represent your cells meaningfully (e.g., ' ' for empty, '#' for occupied).
+            out << static_cast<int>(row[j]) << " ";
+        }
+        out << std::endl;
+    }
+    out << "-------------------" << std::endl;
+}
+
+/**
+ * @brief Renders the whole map into one preformatted text buffer:
+ * '#' for occupied cells, ' ' for empty ones, one line per row.
+ * The buffer is reused between calls, so rendering only allocates when the map grows.
+ * @param map The map to render.
+ * @param buffer Receives the text (previous contents are replaced).
+ * @param withFrame Surround the rows with the same header and footer lines as printMap.
+ */
+void renderMap(const Map& map, std::string& buffer, bool withFrame = true) {
+    static const char header[] = "--- Current Map ---\n";
+    static const char footer[] = "-------------------\n";
+    std::size_t rowBytes = static_cast<std::size_t>(map.width) + 1;
+    std::size_t frameBytes = withFrame ? sizeof(header) - 1 + sizeof(footer) - 1 : 0;
+    buffer.resize(frameBytes + rowBytes * map.height);
+
+    char* out = &buffer[0];
+    if (withFrame) out = std::copy(header, header + sizeof(header) - 1, out);
+    for (int i = 0; i < map.height; ++i) {
+        const Cell* row = map.row(i);
+        for (int j = 0; j < map.width; ++j) out[j] = row[j] ? '#' : ' ';
+        out[map.width] = '\n';
+        out += rowBytes;
+    }
+    if (withFrame) std::copy(footer, footer + sizeof(footer) - 1, out);
+}
+
+/**
+ * @brief Writes a whole buffer to a file descriptor, retrying on partial writes.
+ * @return false if the descriptor reported an error.
+ */
+bool writeBuffer(int fd, const std::string& buffer) {
+    const char* data = buffer.data();
+    std::size_t left = buffer.size();
+    while (left > 0) {
+        ssize_t written = ::write(fd, data, left);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        left -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+/**
+ * @brief Prints the map to standard output with a single write of a prerendered buffer.
+ * @param map The map to print.
+ * @param buffer Scratch buffer reused between calls.
+ */
+void printMapFast(const Map& map, std::string& buffer) {
+    std::cout.flush(); // Mantener el orden con lo ya escrito por std::cout
+    renderMap(map, buffer);
+    writeBuffer(STDOUT_FILENO, buffer);
+}
+
+/**
+ * @brief When the simulation prints the map: after every iteration, only at the end, or never.
+ */
+enum class PrintMode { All, Final, None };
+
+/**
+ * @brief Counters and per-phase wall times of one generation run.
+ * Filled by the instrumentation macros below while a StatsScope is active on the
+ * calling thread; the kernels add to it only through those macros, so building
+ * with -DPCG_NO_INSTRUMENTATION removes every counter and timer.
+ */
+struct RunStats {
+    double caSeconds = 0.0;        // Time in CellularAutomaton::step
+    double agentSeconds = 0.0;     // Time carving with the drunk agents
+    double printSeconds = 0.0;     // Time rendering and writing maps
+    std::uint64_t caIterations = 0;
+    std::uint64_t cellsUpdated = 0; // Cells recomputed by the automaton (all iterations)
+    std::vector<std::uint64_t> cellsChanged; // Cells whose value changed, per CA iteration
+    std::uint64_t agentSteps = 0;
+    std::uint64_t roomsGenerated = 0;
+    std::uint64_t borderBounces = 0; // Steps where the agent hit the map edge and turned
+    std::uint64_t runs = 0;          // Runs merged into these stats
+
+    // Adds other into these stats (cellsChanged is summed per iteration).
+    void merge(const RunStats& other) {
+        caSeconds += other.caSeconds;
+        agentSeconds += other.agentSeconds;
+        printSeconds += other.printSeconds;
+        caIterations += other.caIterations;
+        cellsUpdated += other.cellsUpdated;
+        if (cellsChanged.size() < other.cellsChanged.size()) cellsChanged.resize(other.cellsChanged.size(), 0);
+        for (std::size_t k = 0; k < other.cellsChanged.size(); ++k) cellsChanged[k] += other.cellsChanged[k];
+        agentSteps += other.agentSteps;
+        roomsGenerated += other.roomsGenerated;
+        borderBounces += other.borderBounces;
+        runs += other.runs;
+    }
+
+    // One JSON object on a single line.
+    std::string toJson() const {
+        std::string json = "{\"runs\":" + std::to_string(runs) +
+                           ",\"ca_seconds\":" + std::to_string(caSeconds) +
+                           ",\"agent_seconds\":" + std::to_string(agentSeconds) +
+                           ",\"print_seconds\":" + std::to_string(printSeconds) +
+                           ",\"ca_iterations\":" + std::to_string(caIterations) +
+                           ",\"cells_updated\":" + std::to_string(cellsUpdated) +
+                           ",\"cells_changed\":[";
+        for (std::size_t k = 0; k < cellsChanged.size(); ++k) json += (k ? "," : "") + std::to_string(cellsChanged[k]);
+        json += "],\"agent_steps\":" + std::to_string(agentSteps) +
+                ",\"rooms_generated\":" + std::to_string(roomsGenerated) +
+                ",\"border_bounces\":" + std::to_string(borderBounces) + "}";
+        return json;
+    }
+};
+
+// Stats of the run in progress on this thread (nullptr when nothing is being recorded).
+thread_local RunStats* tActiveStats = nullptr;
+
+/**
+ * @brief Records the instrumentation of the calling thread into stats while alive.
+ * On destruction the previous scope is restored and onFinish (if any) receives the stats.
+ */
+class StatsScope {
+public:
+    explicit StatsScope(RunStats& stats, std::function<void(const RunStats&)> onFinish = nullptr)
+        : stats_(stats), previous_(tActiveStats), onFinish_(std::move(onFinish)) {
+        stats_.runs = std::max<std::uint64_t>(stats_.runs, 1);
+        tActiveStats = &stats_;
+    }
+    StatsScope(const StatsScope&) = delete;
+    StatsScope& operator=(const StatsScope&) = delete;
+
+    ~StatsScope() {
+        tActiveStats = previous_;
+        if (onFinish_) onFinish_(stats_);
+    }
+
+private:
+    RunStats& stats_;
+    RunStats* previous_;
+    std::function<void(const RunStats&)> onFinish_;
+};
+
+/**
+ * @brief Adds the wall time of its lifetime to one RunStats field (if a scope is active).
+ */
+class PhaseTimer {
+public:
+    explicit PhaseTimer(double RunStats::*field)
+        : stats_(tActiveStats), field_(field) {
+        if (stats_ != nullptr) start_ = std::chrono::steady_clock::now();
+    }
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    ~PhaseTimer() {
+        if (stats_ != nullptr) {
+            stats_->*field_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+        }
+    }
+
+private:
+    RunStats* stats_;
+    double RunStats::*field_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#if defined(PCG_NO_INSTRUMENTATION)
+#define PCG_STATS_ENABLED 0
+#define PCG_STAT_ADD(field, amount) ((void)0)
+#define PCG_PHASE_TIMER(field) ((void)0)
+#else
+#define PCG_STATS_ENABLED 1
+#define PCG_STAT_CONCAT_(a, b) a##b
+#define PCG_STAT_CONCAT(a, b) PCG_STAT_CONCAT_(a, b)
+// Suma amount al contador field de la corrida activa en este hilo
+#define PCG_STAT_ADD(field, amount) \
+    do { if (tActiveStats != nullptr) tActiveStats->field += (amount); } while (0)
+// Mide el tiempo hasta el final del bloque y lo suma a field
+#define PCG_PHASE_TIMER(field) PhaseTimer PCG_STAT_CONCAT(pcgPhaseTimer, __LINE__)(&RunStats::field)
+#endif
+
+/**
+ * @brief Fixed-size pool of worker threads, created once and reused.
+ * parallelFor distributes the indices [0, count) over the workers and the
+ * calling thread and returns when all of them are done. Tasks must not throw
+ * and must not call parallelFor on the same pool.
+ */
+class ThreadPool {
+public:
+    /**
+     * @param threads Number of threads that execute tasks, including the caller.
+     *                0 uses std::thread::hardware_concurrency().
+     */
+    explicit ThreadPool(int threads = 0) {
+        if (threads <= 0) threads = static_cast<int>(std::thread::hardware_concurrency());
+        threads = std::max(1, threads);
+        for (int t = 1; t < threads; ++t) {
+            workers_.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads that run tasks (workers plus the calling thread).
+    int size() const { return static_cast<int>(workers_.size()) + 1; }
+
+    /**
+     * @brief Runs task(k) for every k in [0, count) and waits for completion.
+     * Safe to call from several threads; concurrent calls are serialized.
+     * The task is called through a plain function pointer, so no memory is allocated.
+     */
+    template <typename Task>
+    void parallelFor(int count, Task&& task) {
+        using TaskType = std::remove_reference_t<Task>;
+        run(count, [](void* context, int k) { (*static_cast<TaskType*>(context))(k); },
+            const_cast<void*>(static_cast<const void*>(&task)));
+    }
+
+private:
+    void run(int count, void (*invoke)(void*, int), void* context) {
+        if (count <= 0) return;
+        if (workers_.empty() || count == 1) {
+            for (int k = 0; k < count; ++k) invoke(context, k);
+            return;
+        }
+
+        std::lock_guard<std::mutex> call(callMutex_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            invoke_ = invoke;
+            context_ = context;
+            count_ = count;
+            next_.store(0);
+            pending_ = static_cast<int>(workers_.size());
+            ++generation_;
+        }
+        wake_.notify_all();
+
+        runTasks(); // El hilo que llama tambien trabaja
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return pending_ == 0; });
+        invoke_ = nullptr;
+        context_ = nullptr;
+    }
+
+    void runTasks() {
+        for (;;) {
+            int k = next_.fetch_add(1);
+            if (k >= count_) break;
+            invoke_(context_, k);
+        }
+    }
+
+    void workerLoop() {
+        std::uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_) return;
+            seen = generation_;
+            lock.unlock();
+            runTasks();
+            lock.lock();
+            if (--pending_ == 0) done_.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex callMutex_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    void (*invoke_)(void*, int) = nullptr;
+    void* context_ = nullptr;
+    int count_ = 0;
+    std::atomic<int> next_{0};
+    int pending_ = 0;
+    std::uint64_t generation_ = 0;
+    bool stop_ = false;
+};
+
+/**
+ * @brief Fixed-capacity blocking FIFO between two pipeline stages.
+ * push() blocks while the queue is full (backpressure) and pop() while it is empty;
+ * after close(), pop() drains the remaining items and then returns false.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(std::size_t capacity) : slots_(std::max<std::size_t>(1, capacity)) {}
+
+    void push(T value) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this] { return size_ < slots_.size(); });
+        slots_[(head_ + size_) % slots_.size()] = std::move(value);
+        ++size_;
+        notEmpty_.notify_one();
+    }
+
+    bool pop(T& value) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this] { return size_ > 0 || closed_; });
+        if (size_ == 0) return false;
+        value = std::move(slots_[head_]);
+        head_ = (head_ + 1) % slots_.size();
+        --size_;
+        notFull_.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+    }
+
+private:
+    std::vector<T> slots_; // Anillo de capacidad fija: push y pop no reservan memoria
+    std::size_t head_ = 0;
+    std::size_t size_ = 0;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable notFull_;
+    std::condition_variable notEmpty_;
+};
+
+/**
+ * @brief Chain of stages, each on its own threads, connected by bounded queues.
+ * The pipeline owns capacity items that circulate: the first stage takes a free
+ * item and fills it, every other stage processes it in turn, and after the last
+ * stage it goes back to the free list. At most capacity items are in flight, so
+ * memory stays bounded, a slow stage stalls the ones before it (backpressure) and
+ * all stages overlap. Items are reused as they are, so buffers inside them keep
+ * their capacity from one use to the next.
+ */
+template <typename Item>
+class Pipeline {
+public:
+    // Returns false to stop (first stage: no more input) or to drop the item (other stages).
+    using StageFn = std::function<bool(Item&)>;
+
+    // Work of one stage: items processed, time inside the stage function and time blocked on the queues.
+    struct StageStats {
+        std::string name;
+        int threads = 0;
+        std::uint64_t items = 0;
+        double busySeconds = 0.0;
+        double waitSeconds = 0.0;
+    };
+
+    explicit Pipeline(int capacity) : items_(std::max(1, capacity)) {}
+
+    void addStage(const std::string& name, int threads, StageFn fn) {
+        stages_.push_back({name, std::max(1, threads), std::move(fn)});
+    }
+
+    /**
+     * @brief Runs the stages until the first one runs out of input and every item has
+     * gone through the chain. Must not be called concurrently with itself.
+     */
+    void run() {
+        int n = static_cast<int>(stages_.size());
+        if (n == 0) return;
+        std::size_t capacity = items_.size();
+        // queues[0] es la lista de items libres; queues[k] es la entrada de la etapa k
+        std::vector<std::unique_ptr<BoundedQueue<Item*>>> queues;
+        for (int k = 0; k < n; ++k) queues.push_back(std::make_unique<BoundedQueue<Item*>>(capacity));
+        for (Item& item : items_) queues[0]->push(&item);
+
+        stats_.assign(n, StageStats{});
+        std::vector<std::atomic<int>> alive(n);
+        std::mutex statsMutex;
+        std::vector<std::thread> threads;
+        for (int k = 0; k < n; ++k) {
+            stats_[k].name = stages_[k].name;
+            stats_[k].threads = stages_[k].threads;
+            alive[k].store(stages_[k].threads);
+            for (int t = 0; t < stages_[k].threads; ++t) {
+                threads.emplace_back([&, k] {
+                    StageStats local;
+                    auto clock = [] { return std::chrono::steady_clock::now(); };
+                    auto seconds = [](auto from, auto to) { return std::chrono::duration<double>(to - from).count(); };
+                    BoundedQueue<Item*>& free = *queues[0];
+                    BoundedQueue<Item*>& next = (k + 1 < n) ? *queues[k + 1] : free;
+                    for (;;) {
+                        Item* item = nullptr;
+                        auto t0 = clock();
+                        if (!queues[k]->pop(item)) break; // Entrada cerrada y vacia
+                        auto t1 = clock();
+                        bool keep = stages_[k].fn(*item);
+                        auto t2 = clock();
+                        local.waitSeconds += seconds(t0, t1);
+                        local.busySeconds += seconds(t1, t2);
+                        if (!keep) {
+                            free.push(item);
+                            if (k == 0) break; // La fuente no tiene mas trabajo
+                            continue;
+                        }
+                        ++local.items;
+                        next.push(item);
+                        local.waitSeconds += seconds(t2, clock());
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(statsMutex);
+                        stats_[k].items += local.items;
+                        stats_[k].busySeconds += local.busySeconds;
+                        stats_[k].waitSeconds += local.waitSeconds;
+                    }
+                    // El ultimo hilo de la etapa cierra la entrada de la siguiente
+                    if (alive[k].fetch_sub(1) == 1 && k + 1 < n) queues[k + 1]->close();
+                });
+            }
+        }
+        for (std::thread& thread : threads) thread.join();
+    }
+
+    // Stats of the last run, one entry per stage.
+    const std::vector<StageStats>& stats() const { return stats_; }
+
+private:
+    struct Stage {
+        std::string name;
+        int threads;
+        StageFn fn;
+    };
+
+    std::vector<Item> items_;
+    std::vector<Stage> stages_;
+    std::vector<StageStats> stats_;
+};
+
+/**
+ * @brief Strategy used by cellularAutomata to count the neighbors of each cell.
+ * Window walks the full (2R+1)^2 window per cell; Integral reads the count from a
+ * summed-area table in O(1), independently of R; Vector keeps running column sums
+ * and thresholds many cells per SIMD instruction. Auto picks Vector.
+ */
+enum class CountMode { Auto, Window, Integral, Vector };
+
+// Mayor conteo que cabe en los acumuladores de 16 bits con signo del kernel vectorial
+const int kVectorMaxTotal = 32767;
+
+// Mayor ventana (2R+1)^2 admitida (R <= 2047): la tabla de la regla ocupa 2 * (total + 1) bytes
+const std::int64_t kMaxWindowCells = std::int64_t(1) << 24;
+
+/**
+ * @brief Resolves CountMode::Auto to the concrete strategy used for radius R.
+ */
+CountMode resolveCountMode(CountMode mode, int R) {
+    if (mode != CountMode::Auto) return mode;
+    int side = 2 * R + 1;
+    return (side * side <= kVectorMaxTotal) ? CountMode::Vector : CountMode::Integral;
+}
+
+/**
+ * @brief Smallest neighbor count c for which (c / total) >= U.
+ * Evaluated with the same double division as the reference rule, so
+ * "count >= thresholdCount(total, U)" is bit-for-bit equivalent to "ratio >= U".
+ * Returns total + 1 when no count reaches the threshold.
+ */
+int thresholdCount(int total, double U) {
+    for (int c = 0; c <= total; ++c) {
+        if (static_cast<double>(c) / total >= U) return c;
+    }
+    return total + 1;
+}
+
+/**
+ * @brief Cellular automata rule as a lookup table indexed by (current state, window count).
+ * The count is the number of ones in the (2R+1)^2 window around a cell, the cell
+ * itself and the positions outside the map included (as in the original rule), so
+ * any rule costs one table load per cell: next(state, count). Rules that ignore the
+ * state and switch at a single count (the U threshold preset among them) also keep
+ * that count in thresholdCount(), which lets the kernels use a plain comparison.
+ */
+class Ruleset {
+public:
+    Ruleset() : Ruleset(threshold(1, 0.5)) {}
+
+    /**
+     * @brief The original rule: a cell becomes 1 when (count / (2R+1)^2) >= U.
+     */
+    static Ruleset threshold(int R, double U) {
+        Ruleset rules(R, "threshold");
+        int t = ::thresholdCount(rules.total_, U);
+        for (int state = 0; state < 2; ++state) {
+            for (int c = 0; c <= rules.total_; ++c) rules.table_[state * (rules.total_ + 1) + c] = (c >= t) ? 1 : 0;
+        }
+        rules.threshold_ = t;
+        return rules;
+    }
+
+    /**
+     * @brief Birth/survival rule: a 0 becomes 1 when its number of neighbors that are 1
+     * (the window minus the cell itself, 0 .. (2R+1)^2 - 1) is in birth; a 1 stays 1
+     * when it is in survival.
+     */
+    static Ruleset birthSurvival(int R, const std::vector<int>& birth, const std::vector<int>& survival,
+                                 std::string name = "") {
+        Ruleset rules(R, std::move(name));
+        for (int n : birth) {
+            if (n >= 0 && n < rules.total_) rules.table_[n] = 1;
+        }
+        for (int n : survival) {
+            if (n >= 0 && n < rules.total_) rules.table_[rules.total_ + 1 + n + 1] = 1;
+        }
+        rules.detectThreshold();
+        return rules;
+    }
+
+    /**
+     * @brief Parses "B<counts>/S<counts>" (e.g. "B5678/S45678", the classic cave rule).
+     * Counts are single digits, or comma-separated numbers and ranges for larger radii
+     * ("B13-24/S12,14-24"). "threshold" is not accepted here (use threshold()).
+     * @return false if the text is malformed or lists a count outside 0 .. (2R+1)^2 - 1
+     * (or an inverted range). Throws std::invalid_argument if R is out of range (see windowCells).
+     */
+    static bool parse(const std::string& text, int R, Ruleset& rules) {
+        std::size_t slash = text.find('/');
+        if (R < 0 || slash == std::string::npos || text.size() < 3) return false;
+        std::string b = text.substr(0, slash);
+        std::string s = text.substr(slash + 1);
+        if ((b[0] != 'B' && b[0] != 'b') || s.empty() || (s[0] != 'S' && s[0] != 's')) return false;
+        std::vector<int> birth, survival;
+        int maxCount = static_cast<int>(windowCells(R) - 1); // Un vecindario sin la celda central
+        if (!parseCounts(b.substr(1), maxCount, birth) || !parseCounts(s.substr(1), maxCount, survival)) return false;
+        rules = birthSurvival(R, birth, survival, text);
+        return true;
+    }
+
+    int radius() const { return R_; }
+    int total() const { return total_; }
+
+    /**
+     * @brief Cells of the (2R+1)^2 window, computed in 64 bits.
+     * Throws std::invalid_argument if R is negative or the window exceeds kMaxWindowCells.
+     */
+    static std::int64_t windowCells(int R) {
+        std::int64_t side = 2 * static_cast<std::int64_t>(R) + 1;
+        if (R < 0 || side * side > kMaxWindowCells) throw std::invalid_argument("R");
+        return side * side;
+    }
+
+    // Count from which every cell becomes 1 whatever its state, or -1 if the rule is not a threshold.
+    int thresholdCount() const { return threshold_; }
+
+    // Table of 2 * (total() + 1) entries: next(state, count) = table()[state * (total() + 1) + count].
+    const Cell* table() const { return table_.data(); }
+
+    Cell next(Cell state, int count) const { return table_[(state & 1) * (total_ + 1) + count]; }
+
+    // Text the rule was parsed from ("threshold" for the preset).
+    const std::string& name() const { return name_; }
+
+private:
+    Ruleset(int R, std::string name)
+        : R_(R), total_(static_cast<int>(windowCells(R))), name_(std::move(name)) {
+        table_.assign(2 * static_cast<std::size_t>(total_ + 1), 0);
+    }
+
+    // Digitos sueltos ("5678") o lista separada por comas con rangos ("13-24,30"), todos en [0, maxCount]
+    static bool parseCounts(const std::string& text, int maxCount, std::vector<int>& counts) {
+        if (text.find_first_not_of("0123456789,-") != std::string::npos) return false;
+        if (text.find_first_of(",-") == std::string::npos) {
+            for (char c : text) {
+                if (c - '0' > maxCount) return false;
+                counts.push_back(c - '0');
+            }
+            return true;
+        }
+        // Se valida antes de expandir: un rango enorme no llega a reservar memoria
+        auto number = [&](const std::string& digits, int& value) {
+            if (digits.size() > 9) return false;
+            value = std::stoi(digits);
+            return value <= maxCount;
+        };
+        std::size_t start = 0;
+        while (start <= text.size()) {
+            std::size_t end = text.find(',', start);
+            if (end == std::string::npos) end = text.size();
+            std::string item = text.substr(start, end - start);
+            std::size_t dash = item.find('-');
+            if (item.empty() || dash == 0 || dash + 1 == item.size()) return false;
+            int lo = 0;
+            int hi = 0;
+            if (!number(item.substr(0, dash), lo)) return false;
+            if (dash == std::string::npos) hi = lo;
+            else if (!number(item.substr(dash + 1), hi) || hi < lo) return false;
+            for (int n = lo; n <= hi; ++n) counts.push_back(n);
+            start = end + 1;
+        }
+        return true;
+    }
+
+    // Busca un escalon comun a las dos filas; solo cuentan los conteos posibles
+    // (un 0 tiene a lo sumo total - 1 vecinos en 1, un 1 al menos se cuenta a si mismo)
+    void detectThreshold() {
+        threshold_ = -1;
+        for (int t = 0; t <= total_ + 1 && threshold_ < 0; ++t) {
+            bool matches = true;
+            for (int c = 0; c < total_ && matches; ++c) matches = table_[c] == ((c >= t) ? 1 : 0);
+            for (int c = 1; c <= total_ && matches; ++c) matches = table_[total_ + 1 + c] == ((c >= t) ? 1 : 0);
+            if (matches) threshold_ = t;
+        }
+    }
+
+    int R_;
+    int total_;
+    int threshold_ = -1;
+    std::string name_;
+    std::vector<Cell> table_;
+};
+
+/**
+ * @brief Value of the neighbors that fall outside the map.
+ * Solid: every outside cell counts as 1 (the original rule). Empty: they count as 0.
+ * Wrap: the map is a torus. Mirror: the map is reflected on its edges (cell -1 is cell 0).
+ */
+enum class BorderMode { Solid, Empty, Wrap, Mirror };
+
+const char* borderModeName(BorderMode mode) {
+    switch (mode) {
+        case BorderMode::Empty: return "empty";
+        case BorderMode::Wrap: return "wrap";
+        case BorderMode::Mirror: return "mirror";
+        default: return "solid";
+    }
+}
+
+bool parseBorderMode(const std::string& name, BorderMode& mode) {
+    if (name == "solid") mode = BorderMode::Solid;
+    else if (name == "empty") mode = BorderMode::Empty;
+    else if (name == "wrap") mode = BorderMode::Wrap;
+    else if (name == "mirror") mode = BorderMode::Mirror;
+    else return false;
+    return true;
+}
+
+/**
+ * @brief Index inside [0, n) whose value an outside index k takes under a Wrap or Mirror border.
+ */
+int borderSource(int k, int n, BorderMode mode) {
+    if (mode == BorderMode::Wrap) return ((k % n) + n) % n;
+    int period = 2 * n;
+    int m = ((k % period) + period) % period;
+    return (m < n) ? m : period - 1 - m;
+}
+
+/**
+ * @brief Fills the border ring of a padded map according to mode.
+ * Costs O(pad * (W + H)), so it can be refreshed before every step; after it
+ * every read within pad cells of the map is valid and needs no bounds check.
+ */
+void fillBorder(Map& map, BorderMode mode) {
+    int W = map.width;
+    int H = map.height;
+    int P = map.pad;
+    if (P == 0 || W == 0 || H == 0) return;
+    std::size_t fullRow = static_cast<std::size_t>(W) + 2 * P;
+
+    if (mode == BorderMode::Solid || mode == BorderMode::Empty) {
+        Cell value = (mode == BorderMode::Solid) ? 1 : 0;
+        for (int i = 0; i < H; ++i) {
+            std::memset(map.row(i) - P, value, P);
+            std::memset(map.row(i) + W, value, P);
+        }
+        for (int k = 1; k <= P; ++k) {
+            std::memset(map.row(-k) - P, value, fullRow);
+            std::memset(map.row(H - 1 + k) - P, value, fullRow);
+        }
+        return;
+    }
+
+    // Primero las columnas de las filas visibles, luego las filas completas (esquinas incluidas)
+    for (int i = 0; i < H; ++i) {
+        Cell* line = map.row(i);
+        for (int k = 1; k <= P; ++k) {
+            line[-k] = line[borderSource(-k, W, mode)];
+            line[W - 1 + k] = line[borderSource(W - 1 + k, W, mode)];
+        }
+    }
+    for (int k = 1; k <= P; ++k) {
+        std::memcpy(map.row(-k) - P, map.row(borderSource(-k, H, mode)) - P, fullRow);
+        std::memcpy(map.row(H - 1 + k) - P, map.row(borderSource(H - 1 + k, H, mode)) - P, fullRow);
+    }
+}
+
+/**
+ * @brief Scratch memory used by one row band during a cellular automata step.
+ */
+struct BandScratch {
+    std::vector<std::uint32_t> sat;    // Summed-area table (CountMode::Integral)
+    std::vector<std::uint16_t> colSum; // Padded running column sums (CountMode::Vector)
+    std::vector<Cell> ones;            // Row of ones standing in for rows outside the map
+    std::vector<Cell> zeros;
+};
+
+/**
+ * @brief Scratch memory reused across cellular automata steps.
+ * Holds one BandScratch per row band so bands can be processed in parallel.
+ */
+struct CAScratch {
+    std::vector<BandScratch> bands;
+
+    BandScratch& band(int k) {
+        if (static_cast<int>(bands.size()) <= k) bands.resize(k + 1);
+        return bands[k];
+    }
+};
+
+/**
+ * @brief Summed-area table of bit 0 of the rectangle [rowBegin, rowEnd) x [colBegin, colEnd) of a map.
+ * sat[(i - rowBegin + 1) * (colEnd - colBegin + 1) + (j - colBegin + 1)] holds the
+ * number of ones in rows [rowBegin, i], columns [colBegin, j].
+ */
+void buildIntegralImage(const Map& map, int rowBegin, int rowEnd, int colBegin, int colEnd,
+                        std::vector<std::uint32_t>& sat) {
+    int cols = colEnd - colBegin;
+    std::size_t satW = static_cast<std::size_t>(cols) + 1;
+    sat.assign(satW * (static_cast<std::size_t>(rowEnd - rowBegin) + 1), 0);
+    for (int i = rowBegin; i < rowEnd; ++i) {
+        const Cell* src = map.row(i) + colBegin;
+        const std::uint32_t* above = sat.data() + (i - rowBegin) * satW;
+        std::uint32_t* cur = sat.data() + (i - rowBegin + 1) * satW;
+        std::uint32_t rowSum = 0;
+        for (int j = 0; j < cols; ++j) {
+            rowSum += src[j] & 1;
+            cur[j + 1] = above[j + 1] + rowSum;
+        }
+    }
+}
+
+/**
+ * @brief Cellular automata iteration of the cells [rowBegin, rowEnd) x [colBegin, colEnd) using a summed-area table.
+ * Cells outside the map count as 1, exactly as in the window version: the
+ * count is the number of ones inside the clipped window plus the number of
+ * window positions that fall outside the map. The table only spans the
+ * rectangle plus its R-cell halo, so rectangles are independent of each other.
+ * @param sat Scratch buffer for the summed-area table, reused between calls.
+ */
+void integralStep(const Map& src, Map& dst, const Ruleset& rules, int rowBegin, int rowEnd,
+                  int colBegin, int colEnd, std::vector<std::uint32_t>& sat) {
+    int R = rules.radius();
+    int W = src.width;
+    int H = src.height;
+    int haloTop = std::max(0, rowBegin - R);
+    int haloBottom = std::min(H, rowEnd + R);
+    int haloLeft = std::max(0, colBegin - R);
+    int haloRight = std::min(W, colEnd + R);
+    buildIntegralImage(src, haloTop, haloBottom, haloLeft, haloRight, sat);
+
+    int total = rules.total();
+    int threshold = rules.thresholdCount();
+    std::size_t satW = static_cast<std::size_t>(haloRight - haloLeft) + 1;
+
+    for (int i = rowBegin; i < rowEnd; ++i) {
+        int r0 = std::max(0, i - R);
+        int r1 = std::min(H - 1, i + R);
+        const std::uint32_t* top = sat.data() + (r0 - haloTop) * satW;
+        const std::uint32_t* bottom = sat.data() + (r1 - haloTop + 1) * satW;
+        int rows = r1 - r0 + 1;
+        const Cell* state = src.row(i);
+        Cell* out = dst.row(i);
+        for (int j = colBegin; j < colEnd; ++j) {
+            int c0 = std::max(0, j - R);
+            int c1 = std::min(W - 1, j + R) + 1;
+            int ones = static_cast<int>(bottom[c1 - haloLeft] - top[c1 - haloLeft] - bottom[c0 - haloLeft] + top[c0 - haloLeft]);
+            int outside = total - rows * (c1 - c0); // Posiciones fuera del mapa cuentan como 1
+            int count = ones + outside;
+            out[j] = (threshold >= 0) ? (count >= threshold) : rules.next(state[j], count);
+        }
+    }
+}
+
+/**
+ * @brief Cellular automata iteration of the cells [rowBegin, rowEnd) x [colBegin, colEnd) walking the full window of every cell.
+ * Reads only from src and writes only to dst, so a single pass is enough.
+ */
+void windowStep(const Map& src, Map& dst, const Ruleset& rules, int rowBegin, int rowEnd, int colBegin, int colEnd) {
+    int R = rules.radius();
+    int W = src.width;
+    int H = src.height;
+    int side = 2 * R + 1;
+
+    for (int i = rowBegin; i < rowEnd; ++i) {
+        Cell* out = dst.row(i);
+        for (int j = colBegin; j < colEnd; ++j) {
+            int count = 0;
+            for (int dx = -R; dx <= R; ++dx) {
+                int ni = i + dx;
+                if (ni < 0 || ni >= H) {
+                    count += side; // Fila completa fuera del mapa: todos cuentan como 1
+                    continue;
+                }
+                const Cell* in = src.row(ni);
+                for (int dy = -R; dy <= R; ++dy) {
+                    int nj = j + dy;
+                    if (nj >= 0 && nj < W) {
+                        count += in[nj] & 1;  // Leer solo el bit 0 (valor original)
+                    } else {
+                        count += 1; // Bordes se consideran como 1
+                    }
+                }
+            }
+
+            out[j] = rules.next(src.row(i)[j], count); // Una lectura de la tabla por celda
+        }
+    }
+}
+
+/**
+ * @brief Instruction sets available to the vectorized counting kernel.
+ */
+enum class VectorIsa { Scalar, Avx2, Neon };
+
+const char* vectorIsaName(VectorIsa isa) {
+    switch (isa) {
+        case VectorIsa::Avx2: return "avx2";
+        case VectorIsa::Neon: return "neon";
+        default: return "scalar";
+    }
+}
+
+// Largest radius with a compile-time specialized thresholdRow (the production presets are R = 1, 2, 3).
+const int kFixedMaxRadius = 3;
+
+using ThresholdRowFn = void (*)(const std::uint16_t* colPad, Cell* out, int W, int R, int threshold);
+using RuleRowFn = void (*)(const std::uint16_t* colPad, const Cell* state, Cell* out, int W, int R, const Cell* table);
+
+/**
+ * @brief Row kernels used by CountMode::Vector.
+ * accumulate: col[j] += (add[j] & 1) - (sub[j] & 1) for j in [0, W).
+ * thresholdRow: out[j] = (sum of colPad[j .. j + 2R]) >= threshold, for j in [0, W).
+ * thresholdRowFixed[R] is the same kernel instantiated with R as a constant, so
+ * the 2R+1 column sums are fully unrolled; thresholdRowFor() picks it when available.
+ * ruleRow: out[j] = table[(state[j] & 1) * ((2R+1)^2 + 1) + count], with the same
+ * count, for rules that are not a threshold (see Ruleset); ruleRowFixed as above.
+ */
+struct VectorKernels {
+    VectorIsa isa;
+    void (*accumulate)(std::uint16_t* col, const Cell* add, const Cell* sub, int W);
+    ThresholdRowFn thresholdRow;
+    ThresholdRowFn thresholdRowFixed[kFixedMaxRadius + 1];
+    RuleRowFn ruleRow;
+    RuleRowFn ruleRowFixed[kFixedMaxRadius + 1];
+
+    ThresholdRowFn thresholdRowFor(int R) const {
+        return (R >= 1 && R <= kFixedMaxRadius) ? thresholdRowFixed[R] : thresholdRow;
+    }
+
+    RuleRowFn ruleRowFor(int R) const {
+        return (R >= 1 && R <= kFixedMaxRadius) ? ruleRowFixed[R] : ruleRow;
+    }
+};
+
+void accumulateScalar(std::uint16_t* col, const Cell* add, const Cell* sub, int W) {
+    for (int j = 0; j < W; ++j) {
+        col[j] = static_cast<std::uint16_t>(col[j] + (add[j] & 1) - (sub[j] & 1));
+    }
+}
+
+// FixedR > 0 replaces the runtime R by a constant; FixedR == 0 is the generic kernel.
+template <int FixedR>
+void thresholdRowScalar(const std::uint16_t* colPad, Cell* out, int W, int R, int threshold) {
+    int side = 2 * (FixedR > 0 ? FixedR : R) + 1;
+    for (int j = 0; j < W; ++j) {
+        int count = 0;
+        for (int d = 0; d < side; ++d) count += colPad[j + d];
+        out[j] = (count >= threshold) ? 1 : 0;
+    }
+}
+
+template <int FixedR>
+void ruleRowScalar(const std::uint16_t* colPad, const Cell* state, Cell* out, int W, int R, const Cell* table) {
+    int side = 2 * (FixedR > 0 ? FixedR : R) + 1;
+    int stride = side * side + 1; // Distancia entre la fila de las celdas en 0 y la de las celdas en 1
+    for (int j = 0; j < W; ++j) {
+        int count = 0;
+        for (int d = 0; d < side; ++d) count += colPad[j + d];
+        out[j] = table[(state[j] & 1) * stride + count];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+void accumulateAvx2(std::uint16_t* col, const Cell* add, const Cell* sub, int W) {
+    const __m256i one = _mm256_set1_epi16(1);
+    int j = 0;
+    for (; j + 16 <= W; j += 16) {
+        __m256i a = _mm256_and_si256(_mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(add + j))), one);
+        __m256i s = _mm256_and_si256(_mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(sub + j))), one);
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col + j));
+        c = _mm256_add_epi16(_mm256_sub_epi16(c, s), a);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(col + j), c);
+    }
+    accumulateScalar(col + j, add + j, sub + j, W - j);
+}
+
+// Sum of Side consecutive 16-lane column vectors, unrolled as a balanced tree of additions.
+template <int Side>
+__attribute__((target("avx2"))) inline __m256i sumColumnsAvx2(const std::uint16_t* p) {
+    if constexpr (Side == 1) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    } else {
+        return _mm256_add_epi16(sumColumnsAvx2<Side / 2>(p), sumColumnsAvx2<Side - Side / 2>(p + Side / 2));
+    }
+}
+
+template <int FixedR>
+__attribute__((target("avx2")))
+void thresholdRowAvx2(const std::uint16_t* colPad, Cell* out, int W, int R, int threshold) {
+    int side = 2 * (FixedR > 0 ? FixedR : R) + 1;
+    // count >= threshold  <=>  count > threshold - 1 (los conteos caben en int16 con signo)
+    const __m256i limit = _mm256_set1_epi16(static_cast<short>(threshold - 1));
+    const __m128i one = _mm_set1_epi8(1);
+    int j = 0;
+    for (; j + 16 <= W; j += 16) {
+        __m256i count;
+        if constexpr (FixedR > 0) {
+            count = sumColumnsAvx2<2 * FixedR + 1>(colPad + j);
+        } else {
+            count = _mm256_setzero_si256();
+            for (int d = 0; d < side; ++d) {
+                count = _mm256_add_epi16(count, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colPad + j + d)));
+            }
+        }
+        __m256i mask = _mm256_cmpgt_epi16(count, limit);
+        __m128i packed = _mm_packs_epi16(_mm256_castsi256_si128(mask), _mm256_extracti128_si256(mask, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j), _mm_and_si128(packed, one));
+    }
+    thresholdRowScalar<FixedR>(colPad + j, out + j, W - j, R, threshold);
+}
+
+// Calcula con SIMD el indice en la tabla de 16 celdas y luego hace una lectura por celda
+template <int FixedR>
+__attribute__((target("avx2")))
+void ruleRowAvx2(const std::uint16_t* colPad, const Cell* state, Cell* out, int W, int R, const Cell* table) {
+    int side = 2 * (FixedR > 0 ? FixedR : R) + 1;
+    // stride <= kVectorMaxTotal + 1, asi que el indice cabe en 16 bits sin signo
+    const __m256i stride = _mm256_set1_epi16(static_cast<short>(side * side + 1));
+    const __m256i one = _mm256_set1_epi16(1);
+    alignas(32) std::uint16_t index[16];
+    int j = 0;
+    for (; j + 16 <= W; j += 16) {
+        __m256i count;
+        if constexpr (FixedR > 0) {
+            count = sumColumnsAvx2<2 * FixedR + 1>(colPad + j);
+        } else {
+            count = _mm256_setzero_si256();
+            for (int d = 0; d < side; ++d) {
+                count = _mm256_add_epi16(count, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colPad + j + d)));
+            }
+        }
+        __m256i alive = _mm256_and_si256(_mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + j))), one);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(index), _mm256_add_epi16(count, _mm256_mullo_epi16(alive, stride)));
+        for (int k = 0; k < 16; ++k) out[j + k] = table[index[k]];
+    }
+    ruleRowScalar<FixedR>(colPad + j, state + j, out + j, W - j, R, table);
+}
+#endif
+
+#if defined(__ARM_NEON)
+void accumulateNeon(std::uint16_t* col, const Cell* add, const Cell* sub, int W) {
+    const uint8x8_t one = vdup_n_u8(1);
+    int j = 0;
+    for (; j + 8 <= W; j += 8) {
+        uint16x8_t a = vmovl_u8(vand_u8(vld1_u8(add + j), one));
+        uint16x8_t s = vmovl_u8(vand_u8(vld1_u8(sub + j), one));
+        uint16x8_t c = vld1q_u16(col + j);
+        vst1q_u16(col + j, vaddq_u16(vsubq_u16(c, s), a));
+    }
+    accumulateScalar(col + j, add + j, sub + j, W - j);
+}
+
+// Sum of Side consecutive 8-lane column vectors, unrolled as a balanced tree of additions.
+template <int Side>
+inline uint16x8_t sumColumnsNeon(const std::uint16_t* p) {
+    if constexpr (Side == 1) {
+        return vld1q_u16(p);
+    } else {
+        return vaddq_u16(sumColumnsNeon<Side / 2>(p), sumColumnsNeon<Side - Side / 2>(p + Side / 2));
+    }
+}
+
+template <int FixedR>
+void thresholdRowNeon(const std::uint16_t* colPad, Cell* out, int W, int R, int threshold) {
+    int side = 2 * (FixedR > 0 ? FixedR : R) + 1;
+    const uint16x8_t limit = vdupq_n_u16(static_cast<std::uint16_t>(threshold));
+    const uint8x8_t one = vdup_n_u8(1);
+    int j = 0;
+    for (; j + 8 <= W; j += 8) {
+        uint16x8_t count;
+        if constexpr (FixedR > 0) {
+            count = sumColumnsNeon<2 * FixedR + 1>(colPad + j);
+        } else {
+            count = vdupq_n_u16(0);
+            for (int d = 0; d < side; ++d) count = vaddq_u16(count, vld1q_u16(colPad + j + d));
+        }
+        vst1_u8(out + j, vand_u8(vmovn_u16(vcgeq_u16(count, limit)), one));
+    }
+    thresholdRowScalar<FixedR>(colPad + j, out + j, W - j, R, threshold);
+}
+
+template <int FixedR>
+void ruleRowNeon(const std::uint16_t* colPad, const Cell* state, Cell* out, int W, int R, const Cell* table) {
+    int side = 2 * (FixedR > 0 ? FixedR : R) + 1;
+    const uint16x8_t stride = vdupq_n_u16(static_cast<std::uint16_t>(side * side + 1));
+    const uint8x8_t one = vdup_n_u8(1);
+    alignas(16) std::uint16_t index[8];
+    int j = 0;
+    for (; j + 8 <= W; j += 8) {
+        uint16x8_t count;
+        if constexpr (FixedR > 0) {
+            count = sumColumnsNeon<2 * FixedR + 1>(colPad + j);
+        } else {
+            count = vdupq_n_u16(0);
+            for (int d = 0; d < side; ++d) count = vaddq_u16(count, vld1q_u16(colPad + j + d));
+        }
+        uint16x8_t alive = vmovl_u8(vand_u8(vld1_u8(state + j), one));
+        vst1q_u16(index, vmlaq_u16(count, alive, stride));
+        for (int k = 0; k < 8; ++k) out[j + k] = table[index[k]];
+    }
+    ruleRowScalar<FixedR>(colPad + j, state + j, out + j, W - j, R, table);
+}
+#endif
+
+/**
+ * @brief Best instruction set supported by the running CPU.
+ */
+VectorIsa detectVectorIsa() {
+#if defined(__ARM_NEON)
+    return VectorIsa::Neon;
+#elif defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("avx2") ? VectorIsa::Avx2 : VectorIsa::Scalar;
+#else
+    return VectorIsa::Scalar;
+#endif
+}
+
+/**
+ * @brief Kernels for the requested instruction set; falls back to scalar if it is not compiled in.
+ */
+VectorKernels vectorKernelsFor(VectorIsa isa) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (isa == VectorIsa::Avx2) {
+        return {VectorIsa::Avx2, accumulateAvx2, thresholdRowAvx2<0>,
+                {thresholdRowAvx2<0>, thresholdRowAvx2<1>, thresholdRowAvx2<2>, thresholdRowAvx2<3>},
+                ruleRowAvx2<0>, {ruleRowAvx2<0>, ruleRowAvx2<1>, ruleRowAvx2<2>, ruleRowAvx2<3>}};
+    }
+#endif
+#if defined(__ARM_NEON)
+    if (isa == VectorIsa::Neon) {
+        return {VectorIsa::Neon, accumulateNeon, thresholdRowNeon<0>,
+                {thresholdRowNeon<0>, thresholdRowNeon<1>, thresholdRowNeon<2>, thresholdRowNeon<3>},
+                ruleRowNeon<0>, {ruleRowNeon<0>, ruleRowNeon<1>, ruleRowNeon<2>, ruleRowNeon<3>}};
+    }
+#endif
+    return {VectorIsa::Scalar, accumulateScalar, thresholdRowScalar<0>,
+            {thresholdRowScalar<0>, thresholdRowScalar<1>, thresholdRowScalar<2>, thresholdRowScalar<3>},
+            ruleRowScalar<0>, {ruleRowScalar<0>, ruleRowScalar<1>, ruleRowScalar<2>, ruleRowScalar<3>}};
+}
+
+/**
+ * @brief Kernels selected once at runtime for the current CPU.
+ */
+const VectorKernels& vectorKernels() {
+    static const VectorKernels kernels = vectorKernelsFor(detectVectorIsa());
+    return kernels;
+}
+
+/**
+ * @brief Cellular automata iteration of the cells [rowBegin, rowEnd) x [colBegin, colEnd) with the vectorized kernel.
+ * Keeps a running vertical sum of the 2R+1 rows around the current row (rows
+ * outside the map add 1 per column), then sums 2R+1 neighboring column sums
+ * and compares against the integer threshold, many cells per instruction (rules
+ * that are not a threshold look each count up in the Ruleset table instead).
+ * Out-of-range columns contribute a full column of ones through the padding
+ * of the column-sum buffer, so the border rule matches the window version.
+ */
+void vectorStep(const Map& src, Map& dst, const Ruleset& rules, int rowBegin, int rowEnd,
+                int colBegin, int colEnd, BandScratch& scratch, const VectorKernels& kernels) {
+    int R = rules.radius();
+    int W = src.width;
+    int H = src.height;
+    int side = 2 * R + 1;
+    int threshold = rules.thresholdCount();
+
+    // colSum cubre las columnas [colBegin - R, colEnd + R); las que caen fuera del mapa valen side
+    int haloLeft = std::max(0, colBegin - R);
+    int haloRight = std::min(W, colEnd + R);
+    int span = haloRight - haloLeft;
+    scratch.ones.assign(span, 1);
+    scratch.zeros.assign(span, 0);
+    scratch.colSum.assign(static_cast<std::size_t>(colEnd - colBegin) + 2 * R, static_cast<std::uint16_t>(side));
+    std::uint16_t* col = scratch.colSum.data() + (haloLeft - (colBegin - R));
+    std::fill(col, col + span, 0);
+
+    auto rowOrOnes = [&](int ni) { return (ni < 0 || ni >= H) ? scratch.ones.data() : src.row(ni) + haloLeft; };
+    ThresholdRowFn thresholdRow = kernels.thresholdRowFor(R); // Version desenrollada para R = 1..3
+    RuleRowFn ruleRow = kernels.ruleRowFor(R);
+
+    for (int ni = rowBegin - R; ni <= rowBegin + R; ++ni) {
+        kernels.accumulate(col, rowOrOnes(ni), scratch.zeros.data(), span);
+    }
+    for (int i = rowBegin; i < rowEnd; ++i) {
+        if (i > rowBegin) {
+            kernels.accumulate(col, rowOrOnes(i + R), rowOrOnes(i - R - 1), span);
+        }
+        if (threshold >= 0) {
+            thresholdRow(scratch.colSum.data(), dst.row(i) + colBegin, colEnd - colBegin, R, threshold);
+        } else {
+            ruleRow(scratch.colSum.data(), src.row(i) + colBegin, dst.row(i) + colBegin, colEnd - colBegin, R,
+                    rules.table());
+        }
+    }
+}
+
+/**
+ * @brief Cellular automata iteration of the rows [rowBegin, rowEnd) of a padded map, without bounds checks.
+ * src.pad must be at least R and its border ring already filled (fillBorder), so
+ * every neighbor read lands on a visible or border cell: the running column sums
+ * cover the full padded width and each row is thresholded with the vector kernels,
+ * whatever the border mode. dst may have any padding.
+ */
+void paddedStep(const Map& src, Map& dst, const Ruleset& rules, int rowBegin, int rowEnd,
+                BandScratch& scratch, const VectorKernels& kernels) {
+    int R = rules.radius();
+    int W = src.width;
+    int total = rules.total();
+    int threshold = rules.thresholdCount();
+
+    if (total > kVectorMaxTotal) {
+        // Conteos no caben en 16 bits: ventana completa, igualmente sin comprobar bordes
+        for (int i = rowBegin; i < rowEnd; ++i) {
+            Cell* out = dst.row(i);
+            for (int j = 0; j < W; ++j) {
+                int count = 0;
+                for (int dx = -R; dx <= R; ++dx) {
+                    const Cell* in = src.row(i + dx) + j;
+                    for (int dy = -R; dy <= R; ++dy) count += in[dy] & 1;
+                }
+                out[j] = rules.next(src.row(i)[j], count);
+            }
+        }
+        return;
+    }
+
+    int span = W + 2 * R;
+    scratch.zeros.assign(span, 0);
+    scratch.colSum.assign(span, 0);
+    std::uint16_t* col = scratch.colSum.data();
+    ThresholdRowFn thresholdRow = kernels.thresholdRowFor(R);
+    RuleRowFn ruleRow = kernels.ruleRowFor(R);
+
+    for (int ni = rowBegin - R; ni <= rowBegin + R; ++ni) {
+        kernels.accumulate(col, src.row(ni) - R, scratch.zeros.data(), span);
+    }
+    for (int i = rowBegin; i < rowEnd; ++i) {
+        if (i > rowBegin) {
+            kernels.accumulate(col, src.row(i + R) - R, src.row(i - R - 1) - R, span);
+        }
+        if (threshold >= 0) thresholdRow(col, dst.row(i), W, R, threshold);
+        else ruleRow(col, src.row(i), dst.row(i), W, R, rules.table());
+    }
+}
+
+/**
+ * @brief Computes one cellular automata iteration of the cells [rowBegin, rowEnd) x [colBegin, colEnd) from src into dst.
+ */
+void cellularAutomataRect(const Map& src, Map& dst, const Ruleset& rules, CountMode mode,
+                          int rowBegin, int rowEnd, int colBegin, int colEnd, BandScratch& scratch) {
+    switch (resolveCountMode(mode, rules.radius())) {
+        case CountMode::Integral:
+            integralStep(src, dst, rules, rowBegin, rowEnd, colBegin, colEnd, scratch.sat);
+            break;
+        case CountMode::Vector:
+            if (rules.total() <= kVectorMaxTotal) {
+                vectorStep(src, dst, rules, rowBegin, rowEnd, colBegin, colEnd, scratch, vectorKernels());
+                break;
+            }
+            // Conteos no caben en 16 bits
+            integralStep(src, dst, rules, rowBegin, rowEnd, colBegin, colEnd, scratch.sat);
+            break;
+        default:
+            windowStep(src, dst, rules, rowBegin, rowEnd, colBegin, colEnd);
+            break;
+    }
+}
+
+/**
+ * @brief Computes one cellular automata iteration of the rows [rowBegin, rowEnd) from src into dst.
+ */
+void cellularAutomataRows(const Map& src, Map& dst, const Ruleset& rules, CountMode mode,
+                          int rowBegin, int rowEnd, BandScratch& scratch) {
+    cellularAutomataRect(src, dst, rules, mode, rowBegin, rowEnd, 0, src.width, scratch);
+}
+
+/**
+ * @brief Computes one cellular automata iteration from src into dst.
+ * dst must already have the same dimensions as src; no memory is allocated
+ * except for growing the scratch buffers the first time they are needed.
+ * With a thread pool the map is split into one row band per thread; every
+ * band reads its R-row halo from src, so the result is identical to the
+ * serial path regardless of the thread count.
+ * @param src The map in its current state.
+ * @param dst Receives the map after one iteration (must not alias src).
+ * @param rules Rule applied to every cell (Ruleset::threshold(R, U) for the original rule).
+ * @param mode Neighbor counting strategy.
+ * @param scratch Scratch buffers reused between calls.
+ * @param pool Optional thread pool; nullptr runs on the calling thread.
+ */
+void cellularAutomataStep(const Map& src, Map& dst, const Ruleset& rules, CountMode mode,
+                          CAScratch& scratch, ThreadPool* pool = nullptr) {
+    int H = src.height;
+    int bands = (pool != nullptr) ? std::min(pool->size(), H) : 1;
+    if (bands <= 1) {
+        cellularAutomataRows(src, dst, rules, mode, 0, H, scratch.band(0));
+        return;
+    }
+
+    scratch.band(bands - 1); // Reservar las tablas antes de lanzar los hilos
+    pool->parallelFor(bands, [&](int k) {
+        int rowBegin = static_cast<int>(static_cast<long long>(H) * k / bands);
+        int rowEnd = static_cast<int>(static_cast<long long>(H) * (k + 1) / bands);
+        cellularAutomataRows(src, dst, rules, mode, rowBegin, rowEnd, scratch.bands[k]);
+    });
+}
+
+/**
+ * @brief cellularAutomataStep with the threshold rule of radius R and threshold U.
+ * Builds the Ruleset on every call; loops should build it once and use the overload above.
+ */
+void cellularAutomataStep(const Map& src, Map& dst, int R, double U, CountMode mode,
+                          CAScratch& scratch, ThreadPool* pool = nullptr) {
+    cellularAutomataStep(src, dst, Ruleset::threshold(R, U), mode, scratch, pool);
+}
+
+/**
+ * @brief Computes one cellular automata iteration from src into dst under the given border mode.
+ * src must have pad >= R (see withPadding); its border ring is refilled here before
+ * stepping, which is why it is not const. Row bands run on the pool as in cellularAutomataStep.
+ */
+void paddedAutomataStep(Map& src, Map& dst, const Ruleset& rules, BorderMode border,
+                        CAScratch& scratch, ThreadPool* pool = nullptr) {
+    fillBorder(src, border);
+    int H = src.height;
+    int bands = (pool != nullptr) ? std::min(pool->size(), H) : 1;
+    if (bands <= 1) {
+        paddedStep(src, dst, rules, 0, H, scratch.band(0), vectorKernels());
+        return;
+    }
+
+    scratch.band(bands - 1);
+    pool->parallelFor(bands, [&](int k) {
+        int rowBegin = static_cast<int>(static_cast<long long>(H) * k / bands);
+        int rowEnd = static_cast<int>(static_cast<long long>(H) * (k + 1) / bands);
+        paddedStep(src, dst, rules, rowBegin, rowEnd, scratch.bands[k], vectorKernels());
+    });
+}
+
+/**
+ * @brief Function to implement the Cellular Automata logic.
+ * It should take a map and return the updated map after one iteration.
+ * @param currentMap The map in its current state.
+ * @param W Width of the map.
+ * @param H Height of the map.
+ * @param R Radius of the neighbor window (e.g., 1 for 3x3, 2 for 5x5).
+ * @param U Threshold to decide if the current cell becomes 1 or 0.
+ * @param mode Neighbor counting strategy (see CountMode); every mode yields the same map.
+ * @param pool Optional thread pool used to process row bands in parallel.
+ * @return The map after applying the cellular automata rules.
+ */
+Map cellularAutomata(const Map& currentMap, int W, int H, int R, double U, CountMode mode = CountMode::Auto,
+                     ThreadPool* pool = nullptr) {
+    Map newMap(H, W);
+    CAScratch scratch;
+    cellularAutomataStep(currentMap, newMap, Ruleset::threshold(R, U), mode, scratch, pool);
+    return newMap;
+}
+
+// Lado, en celdas, de los tiles con que el automata sigue las zonas que siguen cambiando
+const int kTileSize = 32;
+
+/**
+ * @brief True if the rectangle [rowBegin, rowEnd) x [colBegin, colEnd) differs between two maps.
+ */
+bool rectDiffers(const Map& a, const Map& b, int rowBegin, int rowEnd, int colBegin, int colEnd) {
+    for (int i = rowBegin; i < rowEnd; ++i) {
+        if (std::memcmp(a.row(i) + colBegin, b.row(i) + colBegin, colEnd - colBegin) != 0) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Double-buffered cellular automata runner.
+ * Owns two preallocated maps and swaps them after every step, so stepping
+ * performs a single pass per iteration and no allocations or copies.
+ * current() may be modified between steps (e.g. by the drunk agent).
+ *
+ * With tile tracking enabled the map is split into kTileSize x kTileSize
+ * tiles and a step only recomputes the tiles that changed in the previous
+ * step or have a changed tile within R cells; every other tile is already
+ * identical in both buffers. Edits made through current() must then be
+ * reported with markDirty() or markAllDirty() before the next step.
+ */
+class CellularAutomaton {
+public:
+    /**
+     * @param initial Initial state; copied once into the front buffer.
+     * @param rules Rule applied to every cell.
+     * @param mode Neighbor counting strategy.
+     * @param pool Optional thread pool; must outlive the automaton.
+     * @param border Value of the neighbors outside the map. Other than Solid, the
+     * buffers carry an R-wide border ring and every step runs paddedAutomataStep
+     * over the whole map (mode and tile tracking are then ignored).
+     */
+    CellularAutomaton(const Map& initial, const Ruleset& rules, CountMode mode = CountMode::Auto,
+                      ThreadPool* pool = nullptr, BorderMode border = BorderMode::Solid)
+        : R_(rules.radius()), rules_(rules), mode_(mode), pool_(pool), border_(border) {
+        int pad = (border == BorderMode::Solid) ? 0 : R_;
+        buffers_[0] = (pad > 0) ? withPadding(initial, pad) : initial;
+        buffers_[1] = Map(initial.height, initial.width, 0, pad);
+        tilesX_ = (initial.width + kTileSize - 1) / kTileSize;
+        tilesY_ = (initial.height + kTileSize - 1) / kTileSize;
+    }
+
+    // Threshold rule of radius R and threshold U (Ruleset::threshold).
+    CellularAutomaton(const Map& initial, int R, double U, CountMode mode = CountMode::Auto,
+                      ThreadPool* pool = nullptr, BorderMode border = BorderMode::Solid)
+        : CellularAutomaton(initial, Ruleset::threshold(R, U), mode, pool, border) {}
+
+    /**
+     * @brief Starts a new run over the same buffers and returns the front buffer.
+     * The caller must overwrite its visible cells with the new initial state; the
+     * next step recomputes every tile. Nothing is allocated.
+     */
+    Map& restart() {
+        markAllDirty();
+        return buffers_[front_];
+    }
+
+    // Turns dirty-tile tracking on or off; the first tracked step recomputes every tile.
+    void enableTileTracking(bool enabled) {
+        tracking_ = enabled;
+        markAllDirty();
+    }
+
+    /**
+     * @brief Advances the automaton by one iteration.
+     * @return false if the step changed no cell (the map has converged).
+     */
+    bool step() {
+        Map& src = buffers_[front_];
+        Map& dst = buffers_[1 - front_];
+        bool changed;
+        {
+            // El temporizador cubre solo el paso: el conteo de recordStep no es tiempo del automata
+            PCG_PHASE_TIMER(caSeconds);
+            if (border_ != BorderMode::Solid) {
+                paddedAutomataStep(src, dst, rules_, border_, scratch_, pool_);
+                changed = rectDiffers(src, dst, 0, src.height, 0, src.width);
+                activeTiles_ = tilesX_ * tilesY_;
+            } else if (tracking_) {
+                changed = trackedStep(src, dst);
+            } else {
+                cellularAutomataStep(src, dst, rules_, mode_, scratch_, pool_);
+                changed = rectDiffers(src, dst, 0, src.height, 0, src.width);
+                activeTiles_ = tilesX_ * tilesY_;
+            }
+        }
+#if PCG_STATS_ENABLED
+        if (tActiveStats != nullptr) recordStep(src, dst);
+#endif
+        front_ = 1 - front_;
+        stable_ = !changed;
+        return changed;
+    }
+
+    /**
+     * @brief Advances the automaton by up to n iterations, stopping as soon as a step changes nothing.
+     * @return The number of steps performed.
+     */
+    int run(int n) {
+        for (int k = 0; k < n; ++k) {
+            if (!step()) return k + 1;
+        }
+        return n;
+    }
+
+    // Reports that cell (i, j) of current() was modified outside the automaton.
+    void markDirty(int i, int j) {
+        dirty_[static_cast<std::size_t>(i / kTileSize) * tilesX_ + j / kTileSize] = 1;
+        stable_ = false;
+    }
+
+    void markDirty(const std::vector<CellPos>& cells) {
+        for (const CellPos& cell : cells) markDirty(cell.row, cell.col);
+    }
+
+    void markAllDirty() {
+        dirty_.assign(static_cast<std::size_t>(tilesX_) * tilesY_, 1);
+        stable_ = false;
+    }
+
+    // True when the last step changed nothing and no edit was reported since.
+    bool stable() const { return stable_; }
+
+    // Number of tiles recomputed by the last step.
+    int activeTiles() const { return activeTiles_; }
+
+    Map& current() { return buffers_[front_]; }
+    const Map& current() const { return buffers_[front_]; }
+
+private:
+    // Cuenta celdas recalculadas y cambiadas en el ultimo paso (solo con instrumentacion activa)
+    void recordStep(const Map& src, Map& dst) {
+        int W = src.width;
+        int H = src.height;
+        bool tracked = tracking_ && border_ == BorderMode::Solid;
+        std::uint64_t updated = 0;
+        std::uint64_t changed = 0;
+        for (int ty = 0; ty < tilesY_; ++ty) {
+            for (int tx = 0; tx < tilesX_; ++tx) {
+                if (tracked && !active_[static_cast<std::size_t>(ty) * tilesX_ + tx]) continue;
+                int r1 = std::min(H, (ty + 1) * kTileSize);
+                int c0 = tx * kTileSize;
+                int c1 = std::min(W, c0 + kTileSize);
+                updated += static_cast<std::uint64_t>(r1 - ty * kTileSize) * (c1 - c0);
+                for (int i = ty * kTileSize; i < r1; ++i) {
+                    const Cell* a = src.row(i);
+                    const Cell* b = dst.row(i);
+                    for (int j = c0; j < c1; ++j) changed += (a[j] != b[j]);
+                }
+            }
+        }
+        tActiveStats->caIterations += 1;
+        tActiveStats->cellsUpdated += updated;
+        tActiveStats->cellsChanged.push_back(changed);
+    }
+
+    bool trackedStep(const Map& src, Map& dst) {
+        int W = src.width;
+        int H = src.height;
+        std::size_t tiles = static_cast<std::size_t>(tilesX_) * tilesY_;
+        if (dirty_.size() != tiles) dirty_.assign(tiles, 1);
+
+        // Un tile se recalcula si el o algun tile a menos de R celdas cambio
+        int reach = (R_ + kTileSize - 1) / kTileSize;
+        active_.assign(tiles, 0);
+        activeTiles_ = 0;
+        for (int ty = 0; ty < tilesY_; ++ty) {
+            for (int tx = 0; tx < tilesX_; ++tx) {
+                if (!dirty_[static_cast<std::size_t>(ty) * tilesX_ + tx]) continue;
+                for (int y = std::max(0, ty - reach); y <= std::min(tilesY_ - 1, ty + reach); ++y) {
+                    for (int x = std::max(0, tx - reach); x <= std::min(tilesX_ - 1, tx + reach); ++x) {
+                        active_[static_cast<std::size_t>(y) * tilesX_ + x] = 1;
+                    }
+                }
+            }
+        }
+        for (Cell a : active_) activeTiles_ += a;
+
+        changed_.assign(tiles, 0);
+        auto tileRow = [&](int ty, BandScratch& scratch) {
+            int r0 = ty * kTileSize;
+            int r1 = std::min(H, r0 + kTileSize);
+            const Cell* active = active_.data() + static_cast<std::size_t>(ty) * tilesX_;
+            Cell* changed = changed_.data() + static_cast<std::size_t>(ty) * tilesX_;
+            int tx = 0;
+            while (tx < tilesX_) {
+                if (!active[tx]) {
+                    ++tx;
+                    continue;
+                }
+                // Tiles activos consecutivos se calculan como un solo rectangulo
+                int first = tx;
+                while (tx < tilesX_ && active[tx]) ++tx;
+                cellularAutomataRect(src, dst, rules_, mode_, r0, r1, first * kTileSize,
+                                     std::min(W, tx * kTileSize), scratch);
+                for (int t = first; t < tx; ++t) {
+                    changed[t] = rectDiffers(src, dst, r0, r1, t * kTileSize, std::min(W, (t + 1) * kTileSize));
+                }
+            }
+        };
+
+        int workers = (pool_ != nullptr) ? std::min(pool_->size(), tilesY_) : 1;
+        scratch_.band(std::max(0, workers - 1));
+        if (workers <= 1) {
+            for (int ty = 0; ty < tilesY_; ++ty) tileRow(ty, scratch_.bands[0]);
+        } else {
+            pool_->parallelFor(workers, [&](int k) {
+                for (int ty = k; ty < tilesY_; ty += workers) tileRow(ty, scratch_.bands[k]);
+            });
+        }
+
+        dirty_.swap(changed_);
+        for (Cell d : dirty_) {
+            if (d) return true;
+        }
+        return false;
+    }
+
+    Map buffers_[2];
+    int front_ = 0;
+    int R_;
+    Ruleset rules_;
+    CountMode mode_;
+    ThreadPool* pool_;
+    BorderMode border_;
+    CAScratch scratch_; // Tablas de sumas reutilizadas entre pasos
+
+    bool tracking_ = false;
+    bool stable_ = false;
+    int tilesX_ = 0;
+    int tilesY_ = 0;
+    int activeTiles_ = 0;
+    std::vector<Cell> dirty_;   // Tiles que cambiaron en el ultimo paso o fueron editados
+    std::vector<Cell> active_;  // Tiles a recalcular en el paso actual
+    std::vector<Cell> changed_;
+};
+
+/**
+ * @brief Cellular automaton that updates a single map in place, recomputing only
+ * the cells whose neighborhood changed.
+ * It keeps the list of cells that changed in the previous step plus the cells
+ * reported through markChanged(); a step only evaluates the cells within R of
+ * that list, so after a local edit the work is proportional to the area that
+ * keeps changing instead of W*H. The result is identical to full synchronous
+ * steps as long as every external edit of current() is reported. The first
+ * step (and any step whose candidates cover a large part of the map) runs a
+ * full cellularAutomataStep instead.
+ */
+class IncrementalAutomaton {
+public:
+    /**
+     * @param initial Initial state (copied).
+     * @param rules Rule applied to every cell.
+     */
+    IncrementalAutomaton(const Map& initial, const Ruleset& rules)
+        : map_(initial), R_(rules.radius()), rules_(rules),
+          mark_(static_cast<std::size_t>(initial.width) * initial.height, 0) {}
+
+    // Threshold rule of radius R and threshold U (Ruleset::threshold).
+    IncrementalAutomaton(const Map& initial, int R, double U) : IncrementalAutomaton(initial, Ruleset::threshold(R, U)) {}
+
+    // Reports cells of current() modified outside the automaton (e.g. the agent's touched list).
+    void markChanged(const std::vector<CellPos>& cells) {
+        frontier_.insert(frontier_.end(), cells.begin(), cells.end());
+    }
+
+    void markChanged(int i, int j) { frontier_.push_back({i, j}); }
+
+    // Forces the next step to recompute every cell.
+    void markAllChanged() { full_ = true; }
+
+    /**
+     * @brief Advances the automaton by one iteration.
+     * @return false if the step changed no cell.
+     */
+    bool step() {
+        int W = map_.width;
+        int H = map_.height;
+        std::size_t cells = static_cast<std::size_t>(W) * H;
+        // Con una frontera grande el paso completo (vectorizado) sale mas barato
+        if (!full_ && frontier_.size() > cells / 32) full_ = true;
+        if (!full_) {
+            collectCandidates();
+            full_ = candidates_.size() > cells / 8;
+        }
+        if (full_) {
+            fullStep();
+            full_ = false;
+            return !frontier_.empty();
+        }
+        lastEvaluated_ = candidates_.size();
+
+        // Evaluar todos los candidatos antes de escribir, para que el paso sea sincronico
+        updates_.clear();
+        for (const CellPos& c : candidates_) {
+            Cell value = evaluate(c.row, c.col);
+            if (value != map_(c.row, c.col)) updates_.push_back({c.row, c.col});
+        }
+        for (const CellPos& c : updates_) map_(c.row, c.col) = (map_(c.row, c.col) & 1) ^ 1;
+        frontier_.swap(updates_);
+        return !frontier_.empty();
+    }
+
+    // Cells evaluated by the last step.
+    std::size_t lastEvaluated() const { return lastEvaluated_; }
+
+    // Cells changed by the last step (plus the edits reported since).
+    const std::vector<CellPos>& changed() const { return frontier_; }
+
+    Map& current() { return map_; }
+    const Map& current() const { return map_; }
+
+private:
+    // Celdas a menos de R de alguna celda de la frontera, sin repetir
+    void collectCandidates() {
+        candidates_.clear();
+        if (++epoch_ == 0) { // El contador dio la vuelta: limpiar las marcas
+            std::fill(mark_.begin(), mark_.end(), 0);
+            epoch_ = 1;
+        }
+        int W = map_.width;
+        int H = map_.height;
+        for (const CellPos& c : frontier_) {
+            for (int i = std::max(0, c.row - R_); i <= std::min(H - 1, c.row + R_); ++i) {
+                std::uint32_t* marks = mark_.data() + static_cast<std::size_t>(i) * W;
+                for (int j = std::max(0, c.col - R_); j <= std::min(W - 1, c.col + R_); ++j) {
+                    if (marks[j] != epoch_) {
+                        marks[j] = epoch_;
+                        candidates_.push_back({i, j});
+                    }
+                }
+            }
+        }
+    }
+
+    Cell evaluate(int i, int j) const {
+        int W = map_.width;
+        int H = map_.height;
+        int side = 2 * R_ + 1;
+        int count = 0;
+        for (int ni = i - R_; ni <= i + R_; ++ni) {
+            if (ni < 0 || ni >= H) {
+                count += side; // Fila fuera del mapa: todos cuentan como 1
+                continue;
+            }
+            const Cell* in = map_.row(ni);
+            for (int nj = j - R_; nj <= j + R_; ++nj) {
+                count += (nj >= 0 && nj < W) ? (in[nj] & 1) : 1;
+            }
+        }
+        return rules_.next(map_(i, j), count);
+    }
+
+    void fullStep() {
+        if (next_.width != map_.width || next_.height != map_.height) next_ = Map(map_.height, map_.width);
+        cellularAutomataStep(map_, next_, rules_, CountMode::Auto, scratch_);
+        frontier_.clear();
+        for (int i = 0; i < map_.height; ++i) {
+            const Cell* a = map_.row(i);
+            const Cell* b = next_.row(i);
+            for (int j = 0; j < map_.width; ++j) {
+                if (a[j] != b[j]) frontier_.push_back({i, j});
+            }
+        }
+        std::swap(map_, next_);
+        lastEvaluated_ = static_cast<std::size_t>(map_.width) * map_.height;
+    }
+
+    Map map_;
+    Map next_; // Solo para los pasos completos
+    int R_;
+    Ruleset rules_;
+    bool full_ = true;
+    std::vector<std::uint32_t> mark_; // Epoca en que cada celda fue agregada como candidata
+    std::uint32_t epoch_ = 0;
+    std::vector<CellPos> frontier_;
+    std::vector<CellPos> candidates_;
+    std::vector<CellPos> updates_;
+    std::size_t lastEvaluated_ = 0;
+    CAScratch scratch_;
+};
+
+/**
+ * @brief Bit-packed map: one bit per cell, 64 cells per word.
+ * Cell (i, j) is bit (j % 64) of word j / 64 of row i. The unused bits past
+ * the last column are kept at 1 so they behave like the out-of-bounds border
+ * when the automaton reads across the right edge.
+ */
+struct BitMap {
+    int width = 0;
+    int height = 0;
+    int wordsPerRow = 0;
+    std::vector<std::uint64_t> words;
+
+    BitMap() = default;
+
+    BitMap(int rows, int cols)
+        : width(cols), height(rows), wordsPerRow((cols + 63) / 64),
+          words(static_cast<std::size_t>(rows) * ((cols + 63) / 64), 0) {
+        for (int i = 0; i < height; ++i) {
+            if (wordsPerRow > 0) row(i)[wordsPerRow - 1] |= tailMask();
+        }
+    }
+
+    std::uint64_t* row(int i) { return words.data() + static_cast<std::size_t>(i) * wordsPerRow; }
+    const std::uint64_t* row(int i) const { return words.data() + static_cast<std::size_t>(i) * wordsPerRow; }
+
+    bool get(int i, int j) const { return (row(i)[j >> 6] >> (j & 63)) & 1; }
+    void set(int i, int j, bool value) {
+        std::uint64_t bit = std::uint64_t(1) << (j & 63);
+        if (value) row(i)[j >> 6] |= bit;
+        else row(i)[j >> 6] &= ~bit;
+    }
+
+    // Bits of the last word of each row that lie past the last column.
+    std::uint64_t tailMask() const {
+        int used = width & 63;
+        return used == 0 ? 0 : ~std::uint64_t(0) << used;
+    }
+};
+
+/**
+ * @brief Packs bit 0 of every cell of a Map into a BitMap.
+ */
+BitMap toBitMap(const Map& map) {
+    BitMap bits(map.height, map.width);
+    for (int i = 0; i < map.height; ++i) {
+        const Cell* src = map.row(i);
+        std::uint64_t* dst = bits.row(i);
+        for (int w = 0; w < bits.wordsPerRow; ++w) {
+            int begin = w * 64;
+            int end = std::min(map.width, begin + 64);
+            std::uint64_t word = 0;
+            for (int j = begin; j < end; ++j) {
+                word |= static_cast<std::uint64_t>(src[j] & 1) << (j - begin);
+            }
+            dst[w] = word;
+        }
+        if (bits.wordsPerRow > 0) dst[bits.wordsPerRow - 1] |= bits.tailMask();
+    }
+    return bits;
+}
+
+/**
+ * @brief Unpacks a BitMap into a byte-per-cell Map.
+ */
+Map toMap(const BitMap& bits) {
+    Map map(bits.height, bits.width);
+    for (int i = 0; i < bits.height; ++i) {
+        const std::uint64_t* src = bits.row(i);
+        Cell* dst = map.row(i);
+        for (int j = 0; j < bits.width; ++j) {
+            dst[j] = static_cast<Cell>((src[j >> 6] >> (j & 63)) & 1);
+        }
+    }
+    return map;
+}
+
+// Mayor radio con kernel de bits propio (49 vecinos caben en 6 planos de bits)
+const int kBitMaxRadius = 3;
+
+// Numero de bits necesarios para representar n
+constexpr int bitsFor(int n) { return n == 0 ? 0 : 1 + bitsFor(n >> 1); }
+
+/**
+ * @brief Bit-sliced sum of the 2R+1 horizontal neighbors of every cell of a row.
+ * Writes HP words per column word: plane q at sums[q * words + w].
+ * A nullptr row stands for a row outside the map (all ones).
+ */
+template <int R, int HP>
+void horizontalBitSums(const std::uint64_t* row, int words, std::uint64_t* sums) {
+    const std::uint64_t allOnes = ~std::uint64_t(0);
+    for (int w = 0; w < words; ++w) {
+        // Las palabras fuera del mapa se leen como 1
+        std::uint64_t left = (row == nullptr || w == 0) ? allOnes : row[w - 1];
+        std::uint64_t mid = (row == nullptr) ? allOnes : row[w];
+        std::uint64_t right = (row == nullptr || w + 1 == words) ? allOnes : row[w + 1];
+        std::uint64_t acc[HP] = {};
+        for (int dy = -R; dy <= R; ++dy) {
+            // Bit b = celda (fila, 64 * w + b + dy)
+            std::uint64_t x;
+            if (dy > 0) x = (mid >> dy) | (right << (64 - dy));
+            else if (dy < 0) x = (mid << -dy) | (left >> (64 + dy));
+            else x = mid;
+            for (int q = 0; q < HP; ++q) {
+                std::uint64_t carry = acc[q] & x;
+                acc[q] ^= x;
+                x = carry;
+            }
+        }
+        for (int q = 0; q < HP; ++q) sums[q * words + w] = acc[q];
+    }
+}
+
+/**
+ * @brief Bit-packed iteration for a fixed radius (all loop bounds are compile-time constants).
+ * The 2R+1 horizontal neighbors of every row are first added into a small
+ * bit-sliced counter (one word per bit of the count), computed once per source
+ * row; the counters of the 2R+1 rows of each window are then added together
+ * and compared against the integer threshold with bitwise logic.
+ */
+template <int R>
+void bitStep(const BitMap& src, BitMap& dst, int threshold) {
+    constexpr int side = 2 * R + 1;
+    constexpr int planes = bitsFor(side * side);
+    constexpr int hp = bitsFor(side);
+    int H = src.height;
+    int words = src.wordsPerRow;
+
+    // Sumas horizontales de las 2R+1 filas de la ventana, en un buffer circular
+    std::size_t slot = static_cast<std::size_t>(hp) * words;
+    std::vector<std::uint64_t> ring(slot * side);
+    auto slotOf = [&](int ni) { return ring.data() + static_cast<std::size_t>((ni + side) % side) * slot; };
+    auto fillSlot = [&](int ni) {
+        horizontalBitSums<R, hp>((ni >= 0 && ni < H) ? src.row(ni) : nullptr, words, slotOf(ni));
+    };
+    for (int ni = -R; ni < R; ++ni) fillSlot(ni);
+
+    const std::uint64_t allOnes = ~std::uint64_t(0);
+    for (int i = 0; i < H; ++i) {
+        fillSlot(i + R);
+        const std::uint64_t* rows[side];
+        for (int k = 0; k < side; ++k) rows[k] = slotOf(i - R + k);
+        std::uint64_t* out = dst.row(i);
+        for (int w = 0; w < words; ++w) {
+            std::uint64_t count[planes] = {};
+            for (int k = 0; k < side; ++k) {
+                for (int q = 0; q < hp; ++q) {
+                    std::uint64_t carry = rows[k][q * words + w];
+                    for (int p = q; p < planes; ++p) {
+                        std::uint64_t next = count[p] & carry;
+                        count[p] ^= carry;
+                        carry = next;
+                    }
+                }
+            }
+
+            // count >= threshold, comparando desde el bit mas significativo
+            std::uint64_t greater = 0;
+            std::uint64_t equal = allOnes;
+            if (threshold >= (1 << planes)) {
+                equal = 0;
+            } else {
+                for (int p = planes - 1; p >= 0; --p) {
+                    if ((threshold >> p) & 1) {
+                        equal &= count[p];
+                    } else {
+                        greater |= equal & count[p];
+                        equal &= ~count[p];
+                    }
+                }
+            }
+            out[w] = greater | equal;
+        }
+        if (words > 0) out[words - 1] |= dst.tailMask();
+    }
+}
+
+/**
+ * @brief One cellular automata iteration over a BitMap, 64 cells at a time.
+ * Rows and columns outside the map read as all ones, matching the border rule.
+ * Radii above kBitMaxRadius go through the byte-per-cell kernels instead.
+ * @param src The map in its current state.
+ * @param dst Receives the next state; must have the same dimensions (must not alias src).
+ */
+void cellularAutomataStep(const BitMap& src, BitMap& dst, int R, double U) {
+    int side = 2 * R + 1;
+    int threshold = thresholdCount(side * side, U);
+    switch (R) {
+        case 0: bitStep<0>(src, dst, threshold); break;
+        case 1: bitStep<1>(src, dst, threshold); break;
+        case 2: bitStep<2>(src, dst, threshold); break;
+        case 3: bitStep<3>(src, dst, threshold); break;
+        default:
+            static_assert(kBitMaxRadius == 3, "add the new radii to this switch");
+            dst = toBitMap(cellularAutomata(toMap(src), src.width, src.height, R, U));
+            break;
+    }
+}
+
+/**
+ * @brief Bit-packed counterpart of cellularAutomata (see cellularAutomataStep for BitMap).
+ * @return The map after applying the cellular automata rules.
+ */
+BitMap cellularAutomata(const BitMap& currentMap, int R, double U) {
+    BitMap newMap(currentMap.height, currentMap.width);
+    cellularAutomataStep(currentMap, newMap, R, U);
+    return newMap;
+}
+
+/**
+ * @brief Small, fast PCG32 (XSH-RR) random number generator.
+ * 16 bytes of state instead of the ~5 KB of std::mt19937, so creating one per
+ * map or per thread is free. A given (seed, stream) pair always produces the
+ * same sequence; different streams with the same seed are independent, which
+ * lets parallel workers derive reproducible generators from a single seed.
+ * Satisfies UniformRandomBitGenerator, so it also works with <random> distributions.
+ */
+class Pcg32 {
+public:
+    using result_type = std::uint32_t;
+
+    explicit Pcg32(std::uint64_t seed = 0x853c49e6748fea9bULL, std::uint64_t stream = 0xda3e39cb94b95bdbULL) {
+        seedWith(seed, stream);
+    }
+
+    void seedWith(std::uint64_t seed, std::uint64_t stream = 0xda3e39cb94b95bdbULL) {
+        state_ = 0;
+        inc_ = (stream << 1) | 1;
+        (*this)();
+        state_ += seed;
+        (*this)();
+    }
+
+    result_type operator()() {
+        std::uint64_t old = state_;
+        state_ = old * 6364136223846793005ULL + inc_;
+        std::uint32_t xorshifted = static_cast<std::uint32_t>(((old >> 18) ^ old) >> 27);
+        std::uint32_t rot = static_cast<std::uint32_t>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    // Uniform double in [0, 1) built from 53 random bits.
+    double nextDouble() {
+        std::uint64_t bits = (static_cast<std::uint64_t>((*this)()) << 21) ^ ((*this)() >> 11);
+        return static_cast<double>(bits & ((std::uint64_t(1) << 53) - 1)) * 0x1.0p-53;
+    }
+
+    // Uniform integer in [0, bound) without modulo bias (Lemire's method).
+    std::uint32_t nextBelow(std::uint32_t bound) {
+        std::uint64_t m = static_cast<std::uint64_t>((*this)()) * bound;
+        std::uint32_t low = static_cast<std::uint32_t>(m);
+        if (low < bound) {
+            std::uint32_t floor = (0u - bound) % bound;
+            while (low < floor) {
+                m = static_cast<std::uint64_t>((*this)()) * bound;
+                low = static_cast<std::uint32_t>(m);
+            }
+        }
+        return static_cast<std::uint32_t>(m >> 32);
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xffffffffu; }
+
+private:
+    std::uint64_t state_ = 0;
+    std::uint64_t inc_ = 1;
+};
+
+/**
+ * @brief Seed derived from the clock, for runs that do not need to be reproducible.
+ */
+std::uint64_t clockSeed() {
+    return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+}
+
+// Work done by one drunkWalk call.
+struct WalkCounts {
+    std::uint64_t steps = 0;
+    std::uint64_t rooms = 0;
+    std::uint64_t bounces = 0;
+};
+
+// Adds the counts of a walk to the stats of the run active on this thread.
+void recordWalk(const WalkCounts& counts) {
+    (void)counts;
+    PCG_STAT_ADD(agentSteps, counts.steps);
+    PCG_STAT_ADD(roomsGenerated, counts.rooms);
+    PCG_STAT_ADD(borderBounces, counts.bounces);
+}
+
+/**
+ * @brief Shape of the rooms the drunk agent paints (see RoomStamp).
+ * Rect: the full roomSizeX x roomSizeY box (the original rooms). Ellipse: the ellipse
+ * inscribed in that box. Cross: a horizontal and a vertical bar through the center,
+ * each a third of the box thick.
+ */
+enum class RoomShape { Rect, Ellipse, Cross };
+
+const char* roomShapeName(RoomShape shape) {
+    switch (shape) {
+        case RoomShape::Ellipse: return "ellipse";
+        case RoomShape::Cross: return "cross";
+        default: return "rect";
+    }
+}
+
+bool parseRoomShape(const std::string& name, RoomShape& shape) {
+    if (name == "rect") shape = RoomShape::Rect;
+    else if (name == "ellipse") shape = RoomShape::Ellipse;
+    else if (name == "cross") shape = RoomShape::Cross;
+    else return false;
+    return true;
+}
+
+/**
+ * @brief Precomputed footprint of a room: one run of columns per row, relative to the agent.
+ * Built once per shape and size; blit clips the row range to the map once and each
+ * run with two comparisons, then hands whole runs to the carver (a memset on a plain
+ * map) instead of bounds-checking every cell of the room. Runs are visited row by row,
+ * left to right, the same order as the original room loop.
+ */
+class RoomStamp {
+public:
+    RoomStamp() = default;
+
+    /**
+     * @param shape Shape of the room.
+     * @param roomSizeX, roomSizeY Size of the bounding box in rows and columns; like the
+     *        original rooms it spans roomSize / 2 cells on each side of the agent.
+     */
+    RoomStamp(RoomShape shape, int roomSizeX, int roomSizeY)
+        : shape_(shape), sizeX_(roomSizeX), sizeY_(roomSizeY) {
+        int halfX = roomSizeX / 2;
+        int halfY = roomSizeY / 2;
+        if (halfX < 0 || halfY < 0) return; // Habitacion vacia, como el bucle original
+        halfRows_ = halfX;
+        spans_.reserve(static_cast<std::size_t>(2 * halfX + 1));
+        int barRows = halfX / 3;
+        int barCols = halfY / 3;
+        for (int dr = -halfX; dr <= halfX; ++dr) {
+            int half = halfY;
+            if (shape == RoomShape::Ellipse) {
+                double t = dr / (halfX + 0.5);
+                half = std::min(halfY, static_cast<int>((halfY + 0.5) * std::sqrt(1.0 - t * t)));
+            } else if (shape == RoomShape::Cross && std::abs(dr) > barRows) {
+                half = barCols;
+            }
+            spans_.push_back({-half, half + 1});
+        }
+    }
+
+    // True if the stamp was built for this shape and size.
+    bool matches(RoomShape shape, int roomSizeX, int roomSizeY) const {
+        return shape_ == shape && sizeX_ == roomSizeX && sizeY_ == roomSizeY;
+    }
+
+    /**
+     * @brief Calls carve(row, begin, end) for every run of the room centered on (x, y)
+     * that falls inside an H x W map, with the columns [begin, end) already clipped.
+     */
+    template <typename CarveSpan>
+    void blit(int x, int y, int H, int W, CarveSpan&& carve) const {
+        int first = std::max(-halfRows_, -x);
+        int last = std::min(halfRows_, H - 1 - x);
+        for (int dr = first; dr <= last; ++dr) {
+            const Span& span = spans_[dr + halfRows_];
+            int begin = std::max(0, y + span.begin);
+            int end = std::min(W, y + span.end);
+            if (begin < end) carve(x + dr, begin, end);
+        }
+    }
+
+private:
+    struct Span {
+        int begin; // Primera columna, relativa al agente
+        int end;   // Una despues de la ultima
+    };
+
+    RoomShape shape_ = RoomShape::Rect;
+    int sizeX_ = 0;
+    int sizeY_ = 0;
+    int halfRows_ = -1; // Sin filas: first > last en blit
+    std::vector<Span> spans_;
+};
+
+/**
+ * @brief Walk of one drunk agent over a W x H map, shared by the serial and the concurrent carvers.
+ * Moves the agent exactly as drunkAgent does and calls carve(x, begin, end) for every
+ * run of cells [begin, end) of row x it opens inside the map: one cell per step and
+ * the clipped runs of room for every room. The walk never reads the map, so its path
+ * depends only on its inputs and the rng state.
+ * @return Steps taken, rooms generated and border bounces (for RunStats).
+ */
+template <typename Carve>
+WalkCounts drunkWalk(int W, int H, int J, int I, const RoomStamp& room,
+                     double probGenerateRoom, double probIncreaseRoom,
+                     double probChangeDirection, double probIncreaseChange,
+                     int& agentX, int& agentY, Pcg32& rng, Carve&& carve) {
+    auto chance = [&]() { return rng.nextDouble(); }; // Para decisiones probabilísticas
+    auto dirDist = [&]() { return static_cast<int>(rng.nextBelow(4)); }; // Para escoger direcciones aleatorias
+
+    int dx = 0, dy = 1; // Dirección inicial: hacia la derecha
+    WalkCounts counts;
+    counts.steps = static_cast<std::uint64_t>(std::max(0, J)) * std::max(0, I);
+
+    for (int j = 0; j < J; ++j) {
+        
+        for (int i = 0; i < I; ++i) {
+            // Marcar la posicion actual del agente en el mapa
+            if (agentX >= 0 && agentX < H && agentY >= 0 && agentY < W)
+                carve(agentX, agentY, agentY + 1);
+
+            // Calcular nueva posicion
+            int newX = agentX + dx;
+            int newY = agentY + dy;
+
+            // Si la nueva posicion es valida, mover al agente
+            if (newX >= 0 && newX < H && newY >= 0 && newY < W) {
+                agentX = newX;
+                agentY = newY;
+            } else {
+                // Si se choca con el borde del mapa, cambiar dirección aleatoriamente
+                ++counts.bounces;
+                int dir = dirDist();
+                dx = (dir == 0) ? -1 : (dir == 1) ? 1 : 0;
+                dy = (dir == 2) ? -1 : (dir == 3) ? 1 : 0;
+                continue; // Saltar al siguiente paso sin intentar moverse mas
+            }
+
+            // Cambiar direccion con cierta probabilidad
+            if (chance() < probChangeDirection) {
+                int dir = dirDist();
+                dx = (dir == 0) ? -1 : (dir == 1) ? 1 : 0;
+                dy = (dir == 2) ? -1 : (dir == 3) ? 1 : 0;
+                probChangeDirection = 0.2; // Reiniciar probabilidad de cambio
+            } else {
+                probChangeDirection += probIncreaseChange; // Incrementar probabilidad de cambio
+            }
+        }
+
+        // Intentar generar una habitación con cierta probabilidad
+        if (chance() < probGenerateRoom) {
+            ++counts.rooms;
+            // Dibujar una habitación centrada en la posicion del agente, ya recortada al mapa
+            room.blit(agentX, agentY, H, W, carve);
+            probGenerateRoom = 0.1; // Reiniciar probabilidad de generar habitacion
+        } else {
+            probGenerateRoom += probIncreaseRoom; // Incrementar probabilidad
+        }
+    }
+    return counts;
+}
+
+/**
+ * @brief Appends to out every cell of row[begin, end) (row x of a map) that is not 1.
+ * Tests 8 cells per load, so a span that is already open, the common case once the
+ * caves have formed, costs a few word compares.
+ */
+void recordUnset(const Cell* row, int x, int begin, int end, std::vector<CellPos>& out) {
+    const std::uint64_t ones = 0x0101010101010101ULL;
+    int y = begin;
+    for (; y + 8 <= end; y += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, row + y, 8);
+        if (word == ones) continue;
+        for (int k = y; k < y + 8; ++k) {
+            if (row[k] != 1) out.push_back({x, k});
+        }
+    }
+    for (; y < end; ++y) {
+        if (row[y] != 1) out.push_back({x, y});
+    }
+}
+
+/**
+ * @brief Drunk Agent that carves directly into a caller-owned map.
+ * Same behavior as drunkAgent, but without copying the map: only the cells the
+ * agent walks over and the rooms it paints are written.
+ *
+ * @param map The map to carve into (modified in place).
+ * @param J The number of times the agent "walks" (initiates a path).
+ * @param I The number of steps the agent takes per "walk".
+ * @param room Precomputed stamp of the rooms the agent paints: its shape (RoomShape)
+ *             and bounding box, centered on the agent and clipped to the map.
+ * @param probGenerateRoom Probability (0.0 to 1.0) of generating a room at each step.
+ * @param probIncreaseRoom If no room is generated, this value increases probGenerateRoom.
+ * @param probChangeDirection Probability (0.0 to 1.0) of changing direction at each step.
+ * @param probIncreaseChange If direction is not changed, this value increases probChangeDirection.
+ * @param agentX Current X position of the agent (updated by reference).
+ * @param agentY Current Y position of the agent (updated by reference).
+ * @param rng Random generator driving every decision; the same generator state
+ *            and inputs always produce the same map.
+ * @param touched Optional output; every cell whose value changed is appended to it.
+ */
+void drunkAgentInPlace(Map& map, int J, int I, const RoomStamp& room,
+                       double probGenerateRoom, double probIncreaseRoom,
+                       double probChangeDirection, double probIncreaseChange,
+                       int& agentX, int& agentY, Pcg32& rng,
+                       std::vector<CellPos>* touched = nullptr) {
+    // Marca un tramo de la fila x como 1: primero registra las celdas que van a cambiar y luego un memset
+    auto carve = [&](int x, int begin, int end) {
+        Cell* row = map.row(x);
+        if (touched != nullptr) recordUnset(row, x, begin, end, *touched);
+        std::memset(row + begin, 1, static_cast<std::size_t>(end - begin));
+    };
+    PCG_PHASE_TIMER(agentSeconds);
+    recordWalk(drunkWalk(map.width, map.height, J, I, room, probGenerateRoom, probIncreaseRoom,
+                         probChangeDirection, probIncreaseChange, agentX, agentY, rng, carve));
+}
+
+// drunkAgentInPlace with rectangular rooms of roomSizeX x roomSizeY (builds the stamp on every call).
+void drunkAgentInPlace(Map& map, int J, int I, int roomSizeX, int roomSizeY,
+                       double probGenerateRoom, double probIncreaseRoom,
+                       double probChangeDirection, double probIncreaseChange,
+                       int& agentX, int& agentY, Pcg32& rng,
+                       std::vector<CellPos>* touched = nullptr) {
+    drunkAgentInPlace(map, J, I, RoomStamp(RoomShape::Rect, roomSizeX, roomSizeY), probGenerateRoom,
+                      probIncreaseRoom, probChangeDirection, probIncreaseChange, agentX, agentY, rng, touched);
+}
+
+/**
+ * @brief Position and random stream of one of several concurrent drunk agents, kept between iterations.
+ */
+struct DrunkAgentState {
+    int x;
+    int y;
+    Pcg32 rng;
+    WalkCounts last = {}; // Work of the agent's last walk
+};
+
+/**
+ * @brief Creates count agents for a W x H map, each on its own Pcg32 stream of seed.
+ * Agent 0 starts at the center, like the single agent; the others start at
+ * positions drawn from their own stream. agents is overwritten (its capacity is kept).
+ */
+void makeDrunkAgents(int count, int W, int H, std::uint64_t seed, std::vector<DrunkAgentState>& agents) {
+    agents.clear();
+    agents.reserve(std::max(0, count));
+    for (int k = 0; k < count; ++k) {
+        Pcg32 rng(seed, static_cast<std::uint64_t>(k) + 1);
+        int x = H / 2;
+        int y = W / 2;
+        if (k > 0 && W > 0 && H > 0) {
+            x = static_cast<int>(rng.nextBelow(static_cast<std::uint32_t>(H)));
+            y = static_cast<int>(rng.nextBelow(static_cast<std::uint32_t>(W)));
+        }
+        agents.push_back({x, y, rng});
+    }
+}
+
+// makeDrunkAgents into a new vector.
+std::vector<DrunkAgentState> makeDrunkAgents(int count, int W, int H, std::uint64_t seed) {
+    std::vector<DrunkAgentState> agents;
+    makeDrunkAgents(count, W, H, seed, agents);
+    return agents;
+}
+
+/**
+ * @brief Runs several drunk agents at the same time over one shared map.
+ * Each agent walks as drunkAgentInPlace with its own RNG stream; agents are
+ * spread over the pool and write the shared map with relaxed atomic byte stores
+ * and no locks. Carving only turns cells to 1 and the walks never read the map,
+ * so the final map is the same for any thread count or interleaving.
+ * @param map The map to carve into (modified in place).
+ * @param agents Agent states; positions and RNG states are updated (the final positions are returned here).
+ * @param pool Optional thread pool; nullptr runs the agents one after another.
+ * @param touched Optional output resized to one list per agent, holding the cells the agent changed
+ *                (a cell opened by two agents at once may appear in both lists).
+ */
+void drunkAgentsConcurrent(Map& map, std::vector<DrunkAgentState>& agents, int J, int I,
+                           const RoomStamp& room,
+                           double probGenerateRoom, double probIncreaseRoom,
+                           double probChangeDirection, double probIncreaseChange,
+                           ThreadPool* pool = nullptr,
+                           std::vector<std::vector<CellPos>>* touched = nullptr) {
+    if (touched != nullptr) touched->resize(agents.size());
+    auto runAgent = [&](int k) {
+        std::vector<CellPos>* trail = (touched != nullptr) ? &(*touched)[k] : nullptr;
+        if (trail != nullptr) trail->clear();
+        auto carve = [&](int x, int begin, int end) {
+            Cell* row = map.row(x);
+            for (int y = begin; y < end; ++y) {
+                // Escritura idempotente 0 -> 1: basta con accesos atomicos relajados
+                if (__atomic_load_n(row + y, __ATOMIC_RELAXED) != 1) {
+                    __atomic_store_n(row + y, static_cast<Cell>(1), __ATOMIC_RELAXED);
+                    if (trail != nullptr) trail->push_back({x, y});
+                }
+            }
+        };
+        DrunkAgentState& agent = agents[k];
+        agent.last = drunkWalk(map.width, map.height, J, I, room, probGenerateRoom, probIncreaseRoom,
+                               probChangeDirection, probIncreaseChange, agent.x, agent.y, agent.rng, carve);
+    };
+    PCG_PHASE_TIMER(agentSeconds);
+    int count = static_cast<int>(agents.size());
+    if (pool != nullptr && pool->size() > 1) pool->parallelFor(count, runAgent);
+    else for (int k = 0; k < count; ++k) runAgent(k);
+    for (const DrunkAgentState& agent : agents) recordWalk(agent.last); // En este hilo: las stats son por hilo
+}
+
+// drunkAgentsConcurrent with rectangular rooms of roomSizeX x roomSizeY.
+void drunkAgentsConcurrent(Map& map, std::vector<DrunkAgentState>& agents, int J, int I,
+                           int roomSizeX, int roomSizeY,
+                           double probGenerateRoom, double probIncreaseRoom,
+                           double probChangeDirection, double probIncreaseChange,
+                           ThreadPool* pool = nullptr,
+                           std::vector<std::vector<CellPos>>* touched = nullptr) {
+    drunkAgentsConcurrent(map, agents, J, I, RoomStamp(RoomShape::Rect, roomSizeX, roomSizeY), probGenerateRoom,
+                          probIncreaseRoom, probChangeDirection, probIncreaseChange, pool, touched);
+}
+
+/**
+ * @brief Function to implement the Drunk Agent logic.
+ * It should take a map and parameters controlling the agent's behavior,
+ * then return the updated map after the agent performs its actions.
+ *
+ * @param currentMap The map in its current state.
+ * @param W Width of the map.
+ * @param H Height of the map.
+ * @param J The number of times the agent "walks" (initiates a path).
+ * @param I The number of steps the agent takes per "walk".
+ * @param roomSizeX Max width of rooms the agent can generate.
+ * @param roomSizeY Max height of rooms the agent can generate.
+ * @param probGenerateRoom Probability (0.0 to 1.0) of generating a room at each step.
+ * @param probIncreaseRoom If no room is generated, this value increases probGenerateRoom.
+ * @param probChangeDirection Probability (0.0 to 1.0) of changing direction at each step.
+ * @param probIncreaseChange If direction is not changed, this value increases probChangeDirection.
+ * @param agentX Current X position of the agent (updated by reference).
+ * @param agentY Current Y position of the agent (updated by reference).
+ * @param rng Random generator driving every decision; the same generator state
+ *            and inputs always produce the same map.
+ * @return The map after the agent's movements and actions.
+ */
+
+Map drunkAgent(const Map& currentMap, int W, int H, int J, int I, int roomSizeX, int roomSizeY,
+               double probGenerateRoom, double probIncreaseRoom,
+               double probChangeDirection, double probIncreaseChange,
+               int& agentX, int& agentY, Pcg32& rng) {
+    (void)W;
+    (void)H;
+    Map newMap = currentMap; // The new map is a copy of the current one
+    drunkAgentInPlace(newMap, J, I, roomSizeX, roomSizeY, probGenerateRoom, probIncreaseRoom,
+                      probChangeDirection, probIncreaseChange, agentX, agentY, rng);
+    return newMap; // Devolver el nuevo mapa generado
+}
+
+/**
+ * @brief drunkAgent with an explicit seed: the same seed and inputs always produce the same map.
+ */
+Map drunkAgent(const Map& currentMap, int W, int H, int J, int I, int roomSizeX, int roomSizeY,
+               double probGenerateRoom, double probIncreaseRoom,
+               double probChangeDirection, double probIncreaseChange,
+               int& agentX, int& agentY, std::uint64_t seed) {
+    Pcg32 rng(seed);
+    return drunkAgent(currentMap, W, H, J, I, roomSizeX, roomSizeY, probGenerateRoom, probIncreaseRoom,
+                      probChangeDirection, probIncreaseChange, agentX, agentY, rng);
+}
+
+/**
+ * @brief drunkAgent seeded from the clock (not reproducible between runs).
+ */
+Map drunkAgent(const Map& currentMap, int W, int H, int J, int I, int roomSizeX, int roomSizeY,
+               double probGenerateRoom, double probIncreaseRoom,
+               double probChangeDirection, double probIncreaseChange,
+               int& agentX, int& agentY) {
+    return drunkAgent(currentMap, W, H, J, I, roomSizeX, roomSizeY, probGenerateRoom, probIncreaseRoom,
+                      probChangeDirection, probIncreaseChange, agentX, agentY, clockSeed());
+}
+
+
+// Mayor W*H que labelComponents admite: sus etiquetas y padres son std::int32_t
+const std::int64_t kMaxLabeledCells = std::numeric_limits<std::int32_t>::max();
+
+/**
+ * @brief Result of labelComponents: the connected regions of open cells.
+ */
+struct ComponentReport {
+    int count = 0;                    // Number of regions
+    std::vector<std::uint64_t> sizes; // Cells of region k (labels follow row-major order of first cell)
+    int largest = -1;                 // Label of the largest region (-1 if there are no open cells)
+    std::uint64_t openCells = 0;
+
+    std::uint64_t largestSize() const { return largest >= 0 ? sizes[largest] : 0; }
+};
+
+// Raiz de x con compresion por mitades (cada nodo apunta a su abuelo)
+inline std::int32_t findRoot(std::vector<std::int32_t>& parent, std::int32_t x) {
+    while (parent[x] != x) {
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+    }
+    return x;
+}
+
+// Une los conjuntos de a y b; la raiz es siempre el menor indice, asi que parent[x] <= x para toda celda
+inline void unite(std::vector<std::int32_t>& parent, std::int32_t a, std::int32_t b) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a < b) parent[b] = a;
+    else if (b < a) parent[a] = b;
+}
+
+/**
+ * @brief Labels the connected regions of cells equal to open with a two-pass union-find.
+ * Pass 1 links every open cell to its open neighbors above and to the left (plus
+ * the diagonals above with eightConnected), skipping links already implied by the
+ * neighbors; with a pool the rows are split into bands linked in parallel, each
+ * touching only its own cells, and then the seams between bands are linked.
+ * Pass 2 turns the forest into compact labels in place: every root precedes its
+ * cells in row-major order, so one forward scan suffices. Both passes are linear
+ * in W*H (up to the inverse Ackermann factor). The labels are 32-bit, so maps must have
+ * at most kMaxLabeledCells cells; larger maps throw std::length_error.
+ * @param map The map to analyze.
+ * @param report Receives the regions; its buffers are reused.
+ * @param labels Receives the region label of each cell (row-major, W*H), -1 for non-open cells.
+ * @param open Value of the cells that form regions (1 = cells carved by the agent).
+ * @param eightConnected Also connect diagonal neighbors.
+ * @param pool Optional thread pool for pass 1.
+ */
+void labelComponents(const Map& map, ComponentReport& report, std::vector<std::int32_t>& labels,
+                     Cell open = 1, bool eightConnected = false, ThreadPool* pool = nullptr) {
+    int W = map.width;
+    int H = map.height;
+    if (static_cast<std::int64_t>(W) * H > kMaxLabeledCells) throw std::length_error("labelComponents: map too large");
+    std::vector<std::int32_t>& parent = labels;
+    parent.resize(static_cast<std::size_t>(W) * H);
+
+    // Enlaza la fila i con su fila superior (si withAbove) y con su vecino izquierdo
+    auto linkRow = [&](int i, bool withAbove, bool withLeft) {
+        const Cell* row = map.row(i);
+        const Cell* above = withAbove ? map.row(i - 1) : nullptr;
+        std::int32_t base = i * W;
+        for (int j = 0; j < W; ++j) {
+            if (row[j] != open) continue;
+            std::int32_t x = base + j;
+            bool left = j > 0 && row[j - 1] == open;
+            // x aun es una raiz sola: se cuelga directamente de la raiz de su vecino izquierdo
+            if (left && withLeft) parent[x] = findRoot(parent, x - 1);
+            if (!withAbove) continue;
+            bool upLeft = j > 0 && above[j - 1] == open;
+            if (above[j] == open) {
+                // Si arriba-izquierda tambien esta abierta, izquierda y arriba ya estan unidas a traves de ella
+                if (!(left && upLeft)) unite(parent, x, x - W);
+            } else if (eightConnected) {
+                if (upLeft && !left) unite(parent, x, x - W - 1);
+                if (j + 1 < W && above[j + 1] == open) unite(parent, x, x - W + 1);
+            }
+        }
+    };
+    auto linkBand = [&](int rowBegin, int rowEnd) {
+        for (int i = rowBegin; i < rowEnd; ++i) {
+            const Cell* row = map.row(i);
+            std::int32_t* p = parent.data() + static_cast<std::size_t>(i) * W;
+            std::int32_t base = i * W;
+            for (int j = 0; j < W; ++j) p[j] = (row[j] == open) ? base + j : -1;
+            linkRow(i, i > rowBegin, true); // Mientras la fila sigue en cache
+        }
+    };
+
+    int bands = (pool != nullptr) ? std::min(pool->size(), H) : 1;
+    if (bands <= 1) {
+        linkBand(0, H);
+    } else {
+        auto bandBegin = [&](int k) { return static_cast<int>(static_cast<long long>(H) * k / bands); };
+        pool->parallelFor(bands, [&](int k) { linkBand(bandBegin(k), bandBegin(k + 1)); });
+        // Costuras entre bandas: la primera fila de cada banda con la ultima de la anterior
+        // (la fila ya se enlazo por la izquierda dentro de su banda)
+        for (int k = 1; k < bands; ++k) linkRow(bandBegin(k), true, false);
+    }
+
+    // Segunda pasada: parent[x] < x ya tiene su etiqueta cuando se llega a x
+    report.count = 0;
+    report.sizes.clear();
+    report.largest = -1;
+    report.openCells = 0;
+    std::int32_t* p = parent.data();
+    for (std::size_t x = 0; x < parent.size(); ++x) {
+        if (p[x] < 0) continue;
+        if (p[x] == static_cast<std::int32_t>(x)) {
+            p[x] = report.count++;
+            report.sizes.push_back(0);
+        } else {
+            p[x] = p[p[x]];
+        }
+        ++report.sizes[p[x]];
+    }
+    for (int k = 0; k < report.count; ++k) {
+        report.openCells += report.sizes[k];
+        if (report.largest < 0 || report.sizes[k] > report.sizes[report.largest]) report.largest = k;
+    }
+}
+
+/**
+ * @brief labelComponents returning a new report.
+ * @param labels Optional output: region label of each cell (row-major, W*H), -1 for non-open cells.
+ */
+ComponentReport labelComponents(const Map& map, Cell open = 1, bool eightConnected = false,
+                                ThreadPool* pool = nullptr, std::vector<std::int32_t>* labels = nullptr) {
+    ComponentReport report;
+    std::vector<std::int32_t> local;
+    labelComponents(map, report, (labels != nullptr) ? *labels : local, open, eightConnected, pool);
+    return report;
+}
+
+/**
+ * @brief Closes every open region except the largest one, so all remaining open cells are reachable.
+ * @param map The map to modify.
+ * @param labels Labels returned by labelComponents for this map.
+ * @param report Report returned by labelComponents for this map.
+ * @param open Value of open cells; pockets are set to 1 - open.
+ * @return Number of cells filled.
+ */
+std::uint64_t fillPockets(Map& map, const std::vector<std::int32_t>& labels, const ComponentReport& report,
+                          Cell open = 1) {
+    std::uint64_t filled = 0;
+    const std::int32_t* label = labels.data();
+    for (int i = 0; i < map.height; ++i) {
+        Cell* row = map.row(i);
+        for (int j = 0; j < map.width; ++j, ++label) {
+            if (*label >= 0 && *label != report.largest) {
+                row[j] = static_cast<Cell>(1 - open);
+                ++filled;
+            }
+        }
+    }
+    return filled;
+}
+
+// Mayor numero de niveles de ResolutionPyramid (el nivel 15 ya divide cada lado por 2^15)
+const int kMaxLevels = 16;
+
+/**
+ * @brief Every knob of one generation run (initial fill, cellular automata and drunk agent).
+ * Defaults match the values used by the interactive simulation in main.
+ */
+struct GenParams {
+    int width = 20;
+    int height = 10;
+    int iterations = 5;           // Number of CA + agent iterations
+    double fillProbability = 0.0; // Probability of a cell starting as 1
+
+    // Cellular Automata
+    int R = 1;
+    double U = 0.5;
+    std::string rule;                      // Birth/survival rule ("B5678/S45678"); empty = threshold U
+    BorderMode border = BorderMode::Solid; // Value of the neighbors outside the map
+
+    // Drunk Agent
+    int agents = 1; // Agents carving concurrently (see drunkAgentsConcurrent)
+    int J = 5;
+    int I = 10;
+    int roomSizeX = 5;
+    int roomSizeY = 3;
+    RoomShape roomShape = RoomShape::Rect;
+    double probGenerateRoom = 0.1;
+    double probIncreaseRoom = 0.05;
+    double probChangeDirection = 0.2;
+    double probIncreaseChange = 0.03;
+
+    // Multiresolution (see ResolutionPyramid)
+    int levels = 1;           // Resolution levels (1 .. kMaxLevels); 1 runs every iteration at full resolution
+    int refineIterations = 2; // CA steps at each level finer than the coarsest
+
+    // Connectivity
+    bool fillPockets = false; // Close every open region except the largest (see labelComponents)
+};
+
+/**
+ * @brief Quality metrics of a generated map, as reported by the sweep mode.
+ */
+struct MapMetrics {
+    double openRatio = 0.0;     // Open cells (1) over W*H
+    int components = 0;         // 4-connected open regions
+    double largestRatio = 0.0;  // Cells of the largest region over the open cells
+    double corridorMean = 0.0;  // Mean length of the corridors (0 if there are none)
+    std::uint64_t corridors = 0;
+};
+
+/**
+ * @brief Computes the MapMetrics of a map.
+ * A corridor is a maximal horizontal (vertical) run of at least two open cells whose
+ * neighbors above and below (left and right) are all closed; cells outside the map
+ * count as closed, like the Solid border.
+ * @param labels, report Labeling buffers reused between calls (see labelComponents).
+ */
+MapMetrics measureMap(const Map& map, std::vector<std::int32_t>& labels, ComponentReport& report) {
+    MapMetrics metrics;
+    int W = map.width;
+    int H = map.height;
+    if (W == 0 || H == 0) return metrics;
+    labelComponents(map, report, labels);
+    metrics.components = report.count;
+    metrics.openRatio = static_cast<double>(report.openCells) / (static_cast<double>(W) * H);
+    if (report.openCells > 0) metrics.largestRatio = static_cast<double>(report.largestSize()) / report.openCells;
+
+    auto open = [&](int i, int j) { return map.inBounds(i, j) && map(i, j) == 1; };
+    std::uint64_t length = 0;
+    // Horizontales: la celda abierta con arriba y abajo cerrados; verticales: izquierda y derecha cerradas
+    for (int pass = 0; pass < 2; ++pass) {
+        int outer = pass == 0 ? H : W;
+        int inner = pass == 0 ? W : H;
+        for (int a = 0; a < outer; ++a) {
+            int run = 0;
+            for (int b = 0; b <= inner; ++b) {
+                int i = pass == 0 ? a : b;
+                int j = pass == 0 ? b : a;
+                bool corridor = b < inner && open(i, j) &&
+                                (pass == 0 ? !open(i - 1, j) && !open(i + 1, j) : !open(i, j - 1) && !open(i, j + 1));
+                if (corridor) {
+                    ++run;
+                } else {
+                    if (run >= 2) { // Una celda suelta no es un pasillo
+                        length += run;
+                        ++metrics.corridors;
+                    }
+                    run = 0;
+                }
+            }
+        }
+    }
+    if (metrics.corridors > 0) metrics.corridorMean = static_cast<double>(length) / metrics.corridors;
+    return metrics;
+}
+
+/**
+ * @brief Ruleset of a generation run: params.rule parsed with radius params.R, or the U threshold.
+ * Throws std::invalid_argument if params.rule is malformed, or if R is negative, larger than
+ * the longest side of the map (the window would only add cells outside it) or beyond
+ * Ruleset::windowCells.
+ */
+Ruleset makeRuleset(const GenParams& params) {
+    if (params.R < 0 || params.R > std::max(1, std::max(params.width, params.height))) {
+        throw std::invalid_argument("R");
+    }
+    Ruleset::windowCells(params.R);
+    if (params.rule.empty()) return Ruleset::threshold(params.R, params.U);
+    Ruleset rules;
+    if (!Ruleset::parse(params.rule, params.R, rules)) throw std::invalid_argument("rule");
+    return rules;
+}
+
+/**
+ * @brief Applies the post-generation passes of params to a finished map.
+ * With params.fillPockets, every open region that is not the largest one is closed.
+ * labels and report are the labeling buffers, reused between calls.
+ * @return Number of cells filled.
+ */
+std::uint64_t finishMap(const GenParams& params, Map& map, ThreadPool* pool,
+                        std::vector<std::int32_t>& labels, ComponentReport& report) {
+    if (!params.fillPockets) return 0;
+    labelComponents(map, report, labels, 1, false, pool);
+    return fillPockets(map, labels, report);
+}
+
+// finishMap with temporary labeling buffers.
+std::uint64_t finishMap(const GenParams& params, Map& map, ThreadPool* pool = nullptr) {
+    std::vector<std::int32_t> labels;
+    ComponentReport report;
+    return finishMap(params, map, pool, labels, report);
+}
+
+/**
+ * @brief Coarse-to-fine initial state for multiresolution generation (params.levels > 1).
+ * Level k has ceil(W / 2^k) x ceil(H / 2^k) cells. The coarsest level (levels - 1) is
+ * filled at random and runs params.iterations CA steps, where the large-scale cave
+ * structure settles; each finer level is a nearest-neighbor 2x upsampling of the one
+ * below followed by params.refineIterations steps that smooth the blocky edges. The
+ * full-resolution level is left to the caller, which then runs only the last
+ * refineIterations CA steps (see steps) while the agents carve as usual, so a map
+ * costs a fraction of the full-resolution cell updates. The automata of the coarse
+ * levels are kept and reused while the shape does not change.
+ */
+class ResolutionPyramid {
+public:
+    /**
+     * @brief Writes the upsampled result of the coarse levels into the visible cells of fine.
+     * @param params Generation parameters; fine must be params.width x params.height.
+     * @param rng Random stream of the map; the coarse initial fill is drawn from it.
+     */
+    void run(const GenParams& params, Pcg32& rng, Map& fine) {
+        prepare(params);
+        int coarsest = static_cast<int>(levels_.size()) - 1;
+        for (int k = coarsest; k >= 0; --k) {
+            CellularAutomaton& automaton = *levels_[k];
+            Map& initial = automaton.restart();
+            if (k == coarsest) {
+                for (int i = 0; i < initial.height; ++i) {
+                    Cell* row = initial.row(i);
+                    for (int j = 0; j < initial.width; ++j) row[j] = (rng.nextDouble() < params.fillProbability) ? 1 : 0;
+                }
+            } else {
+                upsample(levels_[k + 1]->current(), initial);
+            }
+            int steps = (k == coarsest) ? params.iterations : params.refineIterations;
+            for (int s = 0; s < steps; ++s) automaton.step();
+        }
+        upsample(levels_[0]->current(), fine);
+    }
+
+    /**
+     * @brief True if full-resolution iteration steps the CA: all of them for a single
+     * level, only the last refineIterations ones otherwise.
+     */
+    static bool steps(const GenParams& params, int iteration) {
+        return params.levels <= 1 || iteration >= params.iterations - params.refineIterations;
+    }
+
+private:
+    // Cada celda fina copia la celda gruesa que la contiene
+    static void upsample(const Map& coarse, Map& fine) {
+        for (int i = 0; i < fine.height; ++i) {
+            const Cell* source = coarse.row(i / 2);
+            Cell* row = fine.row(i);
+            for (int j = 0; j < fine.width; ++j) row[j] = source[j / 2];
+        }
+    }
+
+    // levels_[k] es el nivel k + 1 (el nivel 0, la resolucion completa, lo lleva el llamador)
+    void prepare(const GenParams& params) {
+        int count = std::max(0, std::min(params.levels, kMaxLevels) - 1); // applyGenOptions ya rechaza mas
+        if (static_cast<int>(levels_.size()) == count && shape_.width == params.width &&
+            shape_.height == params.height && shape_.R == params.R && shape_.U == params.U &&
+            shape_.rule == params.rule && shape_.border == params.border) {
+            return;
+        }
+        shape_ = params;
+        levels_.clear();
+        Ruleset rules = makeRuleset(params);
+        for (int k = 1; k <= count; ++k) {
+            int W = std::max(1, (params.width + (1 << k) - 1) >> k);
+            int H = std::max(1, (params.height + (1 << k) - 1) >> k);
+            levels_.push_back(std::make_unique<CellularAutomaton>(Map(H, W, 0), rules, CountMode::Auto, nullptr,
+                                                                  params.border));
+            levels_.back()->enableTileTracking(true);
+        }
+    }
+
+    GenParams shape_;
+    std::vector<std::unique_ptr<CellularAutomaton>> levels_;
+};
+
+/**
+ * @brief Reusable buffers for generating many maps with the same shape.
+ * Owns the automaton (both map buffers, the tile masks and the counting scratch),
+ * the agent trails, the agents and the labeling buffers of fillPockets. They are
+ * sized when the shape (W, H, R, U, rule, border) changes and only rewritten for
+ * the following maps, so steady-state generation performs no heap allocation.
+ * A context is not thread-safe: use one per thread.
+ */
+class GenerationContext {
+public:
+    /**
+     * @brief Generates one map: random initial fill followed by params.iterations
+     * rounds of cellularAutomata and drunkAgent, as in the main loop (with
+     * params.levels > 1 the fill and most CA steps run coarse, see ResolutionPyramid).
+     * Everything random comes from one Pcg32 seeded with seed, so the result depends
+     * only on (params, seed) and maps can be generated concurrently in any order.
+     * With params.agents > 1 the agents carve concurrently on their own streams of
+     * seed (see drunkAgentsConcurrent) and the result does not depend on the pool.
+     * @param params Generation parameters.
+     * @param seed Seed of the map.
+     * @param pool Optional thread pool for the concurrent agents; it must not be the
+     *             pool this call runs on (nested parallelFor on one pool would deadlock).
+     * @return The final map, valid until the next call.
+     */
+    const Map& generate(const GenParams& params, std::uint64_t seed, ThreadPool* pool = nullptr) {
+        Map& map = generateRaw(params, seed, pool);
+        finishMap(params, map, pool, labels_, components_);
+        return map;
+    }
+
+    /**
+     * @brief generate without the post-processing of finishMap, for callers that run
+     * it elsewhere (the batch pipeline does it in its own stage).
+     * @return The map, valid (and writable) until the next call.
+     */
+    Map& generateRaw(const GenParams& params, std::uint64_t seed, ThreadPool* pool = nullptr) {
+        prepare(params);
+        Pcg32 rng(seed);
+        Map& initial = automaton_->restart();
+        if (params.levels > 1) {
+            pyramid_.run(params, rng, initial);
+        } else {
+            for (int i = 0; i < initial.height; ++i) {
+                Cell* row = initial.row(i);
+                if (params.fillProbability > 0.0) {
+                    for (int j = 0; j < initial.width; ++j) row[j] = (rng.nextDouble() < params.fillProbability) ? 1 : 0;
+                } else {
+                    std::memset(row, 0, static_cast<std::size_t>(initial.width));
+                }
+            }
+        }
+
+        int agentX = params.height / 2;
+        int agentY = params.width / 2;
+        agents_.clear();
+        if (params.agents > 1) makeDrunkAgents(params.agents, params.width, params.height, seed, agents_);
+        reserveTrails(params);
+        for (int iteration = 0; iteration < params.iterations; ++iteration) {
+            if (ResolutionPyramid::steps(params, iteration)) automaton_->step();
+            if (agents_.empty()) {
+                touched_.clear();
+                drunkAgentInPlace(automaton_->current(), params.J, params.I, room_,
+                                  params.probGenerateRoom, params.probIncreaseRoom,
+                                  params.probChangeDirection, params.probIncreaseChange,
+                                  agentX, agentY, rng, &touched_);
+                automaton_->markDirty(touched_); // Solo se recalcula alrededor de lo que el agente excavo
+                continue;
+            }
+            drunkAgentsConcurrent(automaton_->current(), agents_, params.J, params.I, room_,
+                                  params.probGenerateRoom, params.probIncreaseRoom,
+                                  params.probChangeDirection, params.probIncreaseChange, pool, &trails_);
+            for (const std::vector<CellPos>& trail : trails_) automaton_->markDirty(trail);
+        }
+        return automaton_->current();
+    }
+
+private:
+    // Rehace los buffers solo si cambia algo que afecta a su tamano o al automata
+    void prepare(const GenParams& params) {
+        if (!room_.matches(params.roomShape, params.roomSizeX, params.roomSizeY)) {
+            room_ = RoomStamp(params.roomShape, params.roomSizeX, params.roomSizeY);
+        }
+        if (automaton_ && shape_.width == params.width && shape_.height == params.height &&
+            shape_.R == params.R && shape_.U == params.U && shape_.rule == params.rule &&
+            shape_.border == params.border) {
+            return;
+        }
+        shape_ = params;
+        automaton_.emplace(Map(params.height, params.width, 0), makeRuleset(params), CountMode::Auto, nullptr,
+                           params.border);
+        automaton_->enableTileTracking(true);
+    }
+
+    // Una caminata excava a lo sumo J * (I + area de la habitacion) celdas distintas, y nunca mas que W*H
+    void reserveTrails(const GenParams& params) {
+        std::size_t room = static_cast<std::size_t>(std::max(0, params.roomSizeX) + 1) * (std::max(0, params.roomSizeY) + 1);
+        std::size_t walk = static_cast<std::size_t>(std::max(0, params.J)) * (std::max(0, params.I) + room);
+        std::size_t bound = std::min(walk, static_cast<std::size_t>(params.width) * params.height);
+        touched_.reserve(bound);
+        if (trails_.size() < agents_.size()) trails_.resize(agents_.size());
+        for (std::size_t k = 0; k < agents_.size(); ++k) trails_[k].reserve(bound);
+    }
+
+    GenParams shape_;
+    std::optional<CellularAutomaton> automaton_;
+    ResolutionPyramid pyramid_;
+    RoomStamp room_;
+    std::vector<CellPos> touched_;
+    std::vector<DrunkAgentState> agents_;
+    std::vector<std::vector<CellPos>> trails_;
+    std::vector<std::int32_t> labels_;
+    ComponentReport components_;
+};
+
+/**
+ * @brief Generates one map with a temporary GenerationContext (see GenerationContext::generate).
+ * Loops generating many maps should keep a context instead, to reuse its buffers.
+ */
+Map generateMap(const GenParams& params, std::uint64_t seed, ThreadPool* pool = nullptr) {
+    GenerationContext context;
+    return context.generate(params, seed, pool);
+}
+
+/**
+ * @brief Host implementation of the resident-grid interface used by generateResident.
+ * It is the reference for the GPU backend and the fallback when CUDA is not compiled in.
+ */
+class CpuGrid {
+public:
+    bool init(const Map& initial, const Ruleset& rules, std::string& error) {
+        (void)error;
+        automaton_ = std::make_unique<CellularAutomaton>(initial, rules);
+        automaton_->enableTileTracking(true);
+        return true;
+    }
+
+    bool step(std::string& error) {
+        (void)error;
+        automaton_->step();
+        return true;
+    }
+
+    // Sets the given cells to 1 (cells already open are left as they are).
+    bool carve(const std::vector<CellPos>& cells, std::string& error) {
+        (void)error;
+        Map& map = automaton_->current();
+        for (const CellPos& c : cells) {
+            if (map(c.row, c.col) != 1) {
+                map(c.row, c.col) = 1;
+                automaton_->markDirty(c.row, c.col);
+            }
+        }
+        return true;
+    }
+
+    bool download(Map& out, std::string& error) const {
+        (void)error;
+        out = automaton_->current();
+        return true;
+    }
+
+private:
+    std::unique_ptr<CellularAutomaton> automaton_;
+};
+
+#if defined(PCG_CUDA)
+// Bloques de 32x8 hilos: una fila de warp por fila del mapa
+const int kGpuBlockX = 32;
+const int kGpuBlockY = 8;
+
+/**
+ * @brief One CA iteration on the device with shared-memory tiles.
+ * Each block loads its (8 + 2R) x (32 + 2R) tile (cells outside the map read as 1),
+ * computes the vertical sums of 2R+1 rows per tile column once, and every thread
+ * adds 2R+1 of those sums for its cell, so a cell costs O(R) shared-memory reads.
+ */
+__global__ void gpuStepKernel(const Cell* src, Cell* dst, int W, int H, int pitch, int R, int threshold) {
+    extern __shared__ unsigned char gpuShared[];
+    int tileW = blockDim.x + 2 * R;
+    int tileH = blockDim.y + 2 * R;
+    Cell* tile = gpuShared;
+    std::uint16_t* colSum = reinterpret_cast<std::uint16_t*>(gpuShared + ((tileW * tileH + 1) & ~1));
+
+    int originRow = static_cast<int>(blockIdx.y * blockDim.y) - R;
+    int originCol = static_cast<int>(blockIdx.x * blockDim.x) - R;
+    int thread = threadIdx.y * blockDim.x + threadIdx.x;
+    int threads = blockDim.x * blockDim.y;
+
+    for (int k = thread; k < tileW * tileH; k += threads) {
+        int i = originRow + k / tileW;
+        int j = originCol + k % tileW;
+        tile[k] = (i >= 0 && i < H && j >= 0 && j < W) ? (src[static_cast<std::size_t>(i) * pitch + j] & 1) : 1;
+    }
+    __syncthreads();
+
+    // Sumas verticales de las 2R+1 filas alrededor de cada fila del bloque
+    for (int k = thread; k < static_cast<int>(blockDim.y) * tileW; k += threads) {
+        int ty = k / tileW;
+        int tx = k % tileW;
+        int sum = 0;
+        for (int d = 0; d <= 2 * R; ++d) sum += tile[(ty + d) * tileW + tx];
+        colSum[k] = static_cast<std::uint16_t>(sum);
+    }
+    __syncthreads();
+
+    int i = blockIdx.y * blockDim.y + threadIdx.y;
+    int j = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= H || j >= W) return;
+    const std::uint16_t* sums = colSum + threadIdx.y * tileW + threadIdx.x;
+    int count = 0;
+    for (int d = 0; d <= 2 * R; ++d) count += sums[d];
+    dst[static_cast<std::size_t>(i) * pitch + j] = (count >= threshold) ? 1 : 0;
+}
+
+// Marca como 1 las celdas excavadas por el agente en el host
+__global__ void gpuCarveKernel(Cell* grid, int pitch, const CellPos* cells, int count) {
+    int k = blockIdx.x * blockDim.x + threadIdx.x;
+    if (k < count) grid[static_cast<std::size_t>(cells[k].row) * pitch + cells[k].col] = 1;
+}
+
+/**
+ * @brief Device implementation of the resident-grid interface.
+ * The grid stays in device memory (two buffers swapped every step); only the
+ * cells carved by the agents are uploaded between steps, and the map is copied
+ * back once by download(). Supports the Solid border only.
+ */
+class CudaGrid {
+public:
+    CudaGrid() = default;
+    CudaGrid(const CudaGrid&) = delete;
+    CudaGrid& operator=(const CudaGrid&) = delete;
+    ~CudaGrid() { release(); }
+
+    bool init(const Map& initial, const Ruleset& rules, std::string& error) {
+        release();
+        if (rules.thresholdCount() < 0) {
+            error = "the GPU kernel only supports threshold rules";
+            return false;
+        }
+        int R = rules.radius();
+        W_ = initial.width;
+        H_ = initial.height;
+        pitch_ = initial.stride;
+        R_ = R;
+        threshold_ = rules.thresholdCount();
+        int tileW = kGpuBlockX + 2 * R;
+        int tileH = kGpuBlockY + 2 * R;
+        shared_ = static_cast<std::size_t>((tileW * tileH + 1) & ~1) + sizeof(std::uint16_t) * kGpuBlockY * tileW;
+        if (shared_ > 48 * 1024) {
+            error = "radius too large for the GPU kernel";
+            return false;
+        }
+        std::size_t bytes = static_cast<std::size_t>(H_) * pitch_;
+        if (!check(cudaMalloc(&buffers_[0], bytes), error) || !check(cudaMalloc(&buffers_[1], bytes), error)) {
+            return false;
+        }
+        return check(cudaMemcpy(buffers_[0], initial.row(0), bytes, cudaMemcpyHostToDevice), error);
+    }
+
+    bool step(std::string& error) {
+        dim3 block(kGpuBlockX, kGpuBlockY);
+        dim3 grid((W_ + kGpuBlockX - 1) / kGpuBlockX, (H_ + kGpuBlockY - 1) / kGpuBlockY);
+        PCG_CUDA_LAUNCH(gpuStepKernel, grid, block, shared_,
+                        buffers_[front_], buffers_[1 - front_], W_, H_, pitch_, R_, threshold_);
+        if (!check(cudaGetLastError(), error)) return false;
+        front_ = 1 - front_;
+        return true;
+    }
+
+    bool carve(const std::vector<CellPos>& cells, std::string& error) {
+        if (cells.empty()) return true;
+        if (cells.size() > carveCapacity_) {
+            cudaFree(carveList_);
+            carveList_ = nullptr;
+            carveCapacity_ = 0;
+            if (!check(cudaMalloc(&carveList_, cells.size() * sizeof(CellPos)), error)) return false;
+            carveCapacity_ = cells.size();
+        }
+        if (!check(cudaMemcpy(carveList_, cells.data(), cells.size() * sizeof(CellPos), cudaMemcpyHostToDevice),
+                   error)) {
+            return false;
+        }
+        int count = static_cast<int>(cells.size());
+        PCG_CUDA_LAUNCH(gpuCarveKernel, dim3((count + 255) / 256), dim3(256), 0,
+                        buffers_[front_], pitch_, carveList_, count);
+        return check(cudaGetLastError(), error);
+    }
+
+    // cudaMemcpy espera a los kernels pendientes, asi que tambien reporta sus errores de ejecucion
+    bool download(Map& out, std::string& error) const {
+        Map map(H_, W_);
+        if (!check(cudaMemcpy(map.row(0), buffers_[front_], static_cast<std::size_t>(H_) * pitch_,
+                              cudaMemcpyDeviceToHost), error)) {
+            return false;
+        }
+        out = std::move(map);
+        return true;
+    }
+
+private:
+    static bool check(cudaError_t status, std::string& error) {
+        if (status == cudaSuccess) return true;
+        error = cudaGetErrorString(status);
+        return false;
+    }
+
+    void release() {
+        cudaFree(buffers_[0]);
+        cudaFree(buffers_[1]);
+        cudaFree(carveList_);
+        buffers_[0] = buffers_[1] = nullptr;
+        carveList_ = nullptr;
+        carveCapacity_ = 0;
+        front_ = 0;
+    }
+
+    Cell* buffers_[2] = {nullptr, nullptr};
+    int front_ = 0;
+    CellPos* carveList_ = nullptr;
+    std::size_t carveCapacity_ = 0;
+    int W_ = 0;
+    int H_ = 0;
+    int pitch_ = 0;
+    int R_ = 0;
+    int threshold_ = 0;
+    std::size_t shared_ = 0;
+};
+#endif
+
+/**
+ * @brief generateMap over a resident grid: the map stays in the grid for the whole run.
+ * The agents never read the map, so their walks are recorded as carve lists on the host
+ * and pushed to the grid after each step; only the final map is downloaded.
+ * Uses the random stream in the same order as generateMap, so both give the same map.
+ * @return false (and error) if the grid cannot be initialized or a step, carve or
+ * download fails; the map is then incomplete and the caller must not use it.
+ */
+template <typename Grid>
+bool generateResident(const GenParams& params, std::uint64_t seed, Grid& grid, Map& out, std::string& error) {
+    Pcg32 rng(seed);
+    Map initial(params.height, params.width, 0);
+    if (params.fillProbability > 0.0) {
+        for (int i = 0; i < initial.height; ++i) {
+            Cell* row = initial.row(i);
+            for (int j = 0; j < initial.width; ++j) row[j] = (rng.nextDouble() < params.fillProbability) ? 1 : 0;
+        }
+    }
+    if (!grid.init(initial, makeRuleset(params), error)) return false;
+
+    int agentX = params.height / 2;
+    int agentY = params.width / 2;
+    std::vector<DrunkAgentState> agents;
+    if (params.agents > 1) agents = makeDrunkAgents(params.agents, params.width, params.height, seed);
+    RoomStamp room(params.roomShape, params.roomSizeX, params.roomSizeY);
+    std::vector<CellPos> carved;
+    auto record = [&](int x, int begin, int end) {
+        for (int y = begin; y < end; ++y) carved.push_back({x, y});
+    };
+    for (int iteration = 0; iteration < params.iterations; ++iteration) {
+        {
+            PCG_PHASE_TIMER(caSeconds);
+            if (!grid.step(error)) return false;
+        }
+        PCG_PHASE_TIMER(agentSeconds);
+        carved.clear();
+        if (agents.empty()) {
+            recordWalk(drunkWalk(params.width, params.height, params.J, params.I, room,
+                                 params.probGenerateRoom, params.probIncreaseRoom,
+                                 params.probChangeDirection, params.probIncreaseChange, agentX, agentY, rng, record));
+        }
+        for (DrunkAgentState& agent : agents) {
+            recordWalk(drunkWalk(params.width, params.height, params.J, params.I, room,
+                                 params.probGenerateRoom, params.probIncreaseRoom,
+                                 params.probChangeDirection, params.probIncreaseChange, agent.x, agent.y, agent.rng,
+                                 record));
+        }
+        if (!grid.carve(carved, error)) return false;
+    }
+    if (!grid.download(out, error)) return false;
+    finishMap(params, out);
+    return true;
+}
+
+/**
+ * @brief True if this build has the CUDA backend and a device is present.
+ */
+bool gpuBackendAvailable() {
+#if defined(PCG_CUDA)
+    int devices = 0;
+    return cudaGetDeviceCount(&devices) == cudaSuccess && devices > 0;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief generateMap on the GPU, falling back to the CPU when it is not available.
+ * The GPU path needs a CUDA build (nvcc -x cu), a device, the Solid border and a
+ * threshold rule;
+ * otherwise, or if the device cannot be initialized, the map is generated on the
+ * CPU and the reason is stored in fallbackReason (when given). The output is the
+ * same on both paths.
+ */
+Map generateMapGpu(const GenParams& params, std::uint64_t seed, std::string* fallbackReason = nullptr) {
+    std::string error = "built without CUDA";
+#if defined(PCG_CUDA)
+    if (params.border != BorderMode::Solid) {
+        error = "the GPU backend only supports --border=solid";
+    } else if (params.levels > 1) {
+        error = "the GPU backend does not support --levels";
+    } else if (!gpuBackendAvailable()) {
+        error = "no CUDA device";
+    } else {
+        CudaGrid grid;
+        Map out;
+        if (generateResident(params, seed, grid, out, error)) return out;
+    }
+#endif
+    if (fallbackReason != nullptr) *fallbackReason = error;
+    return generateMap(params, seed);
+}
+
+/**
+ * @brief Payload encodings of the binary map format.
+ * Bits: BitMap rows stored as-is (64 cells per word, in host byte order), readable in place.
+ * Rle: alternating run lengths (starting with a run of zeros) over the row-major
+ * cells, each a LEB128 varint; smaller for smooth caves but decoded on load.
+ */
+enum class MapEncoding : std::uint16_t { Bits = 0, Rle = 1 };
+
+/**
+ * @brief Fixed-size header of a binary map file (.pcgm), followed by the payload.
+ * The header is memcpy'd as-is, so every field (and every Bits word) is in host byte
+ * order: files are portable between machines of the same endianness (the little-endian
+ * x86-64 and AArch64 targets). The payload starts at offset sizeof(MapFileHeader),
+ * a multiple of 8, so a memory-mapped Bits payload can be read as 64-bit words.
+ */
+struct MapFileHeader {
+    char magic[4];              // "PCGM"
+    std::uint16_t version;      // kMapFileVersion
+    std::uint16_t encoding;     // MapEncoding
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint64_t seed;
+    std::int32_t iterations;
+    std::int32_t R;
+    double U;
+    double fillProbability;
+    std::int32_t J;
+    std::int32_t I;
+    std::int32_t roomSizeX;
+    std::int32_t roomSizeY;
+    double probGenerateRoom;
+    double probIncreaseRoom;
+    double probChangeDirection;
+    double probIncreaseChange;
+    std::uint64_t payloadBytes;
+    std::uint64_t checksum;     // payloadChecksum of the payload bytes
+};
+static_assert(sizeof(MapFileHeader) == 112 && sizeof(MapFileHeader) % 8 == 0, "unexpected MapFileHeader layout");
+
+const std::uint16_t kMapFileVersion = 1;
+
+// Mayor W*H que se acepta al leer un archivo (el BitMap decodificado ocupa W*H / 8 bytes)
+const std::uint64_t kMaxMapFileCells = std::uint64_t(1) << 32;
+
+/**
+ * @brief 64-bit FNV-1a over 8-byte words (then the remaining bytes) of a buffer.
+ */
+std::uint64_t payloadChecksum(const unsigned char* data, std::size_t size) {
+    const std::uint64_t prime = 0x100000001b3ULL;
+    std::uint64_t hash = 0xcbf29ce484222325ULL;
+    std::size_t k = 0;
+    for (; k + 8 <= size; k += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data + k, 8);
+        hash = (hash ^ word) * prime;
+    }
+    for (; k < size; ++k) hash = (hash ^ data[k]) * prime;
+    return hash;
+}
+
+/**
+ * @brief Serializes a map and the parameters that generated it into the binary format.
+ * @param map The map to store.
+ * @param params Parameters recorded in the header.
+ * @param seed Seed recorded in the header.
+ * @param encoding Payload encoding.
+ * @param out Receives the header followed by the payload (previous contents are replaced).
+ */
+void encodeMapBinary(const Map& map, const GenParams& params, std::uint64_t seed,
+                     MapEncoding encoding, std::string& out) {
+    MapFileHeader header{};
+    std::memcpy(header.magic, "PCGM", 4);
+    header.version = kMapFileVersion;
+    header.encoding = static_cast<std::uint16_t>(encoding);
+    header.width = static_cast<std::uint32_t>(map.width);
+    header.height = static_cast<std::uint32_t>(map.height);
+    header.seed = seed;
+    header.iterations = params.iterations;
+    header.R = params.R;
+    header.U = params.U;
+    header.fillProbability = params.fillProbability;
+    header.J = params.J;
+    header.I = params.I;
+    header.roomSizeX = params.roomSizeX;
+    header.roomSizeY = params.roomSizeY;
+    header.probGenerateRoom = params.probGenerateRoom;
+    header.probIncreaseRoom = params.probIncreaseRoom;
+    header.probChangeDirection = params.probChangeDirection;
+    header.probIncreaseChange = params.probIncreaseChange;
+
+    out.assign(sizeof(MapFileHeader), '\0');
+    if (encoding == MapEncoding::Bits) {
+        BitMap bits = toBitMap(map);
+        const char* words = reinterpret_cast<const char*>(bits.words.data());
+        out.append(words, bits.words.size() * sizeof(std::uint64_t));
+    } else {
+        // Largo de cada racha como varint LEB128, alternando 0 y 1
+        auto putVarint = [&](std::uint64_t value) {
+            while (value >= 0x80) {
+                out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        };
+        Cell current = 0;
+        std::uint64_t run = 0;
+        for (int i = 0; i < map.height; ++i) {
+            const Cell* row = map.row(i);
+            for (int j = 0; j < map.width; ++j) {
+                Cell value = row[j] & 1;
+                if (value != current) {
+                    putVarint(run);
+                    current = value;
+                    run = 0;
+                }
+                ++run;
+            }
+        }
+        putVarint(run);
+    }
+
+    header.payloadBytes = out.size() - sizeof(MapFileHeader);
+    header.checksum = payloadChecksum(reinterpret_cast<const unsigned char*>(out.data()) + sizeof(MapFileHeader),
+                                      header.payloadBytes);
+    std::memcpy(&out[0], &header, sizeof(header));
+}
+
+/**
+ * @brief Writes a map to a binary file (see encodeMapBinary).
+ * @return false if the file could not be written.
+ */
+bool saveMapBinary(const std::string& path, const Map& map, const GenParams& params, std::uint64_t seed,
+                   MapEncoding encoding = MapEncoding::Bits) {
+    std::string buffer;
+    encodeMapBinary(map, params, seed, encoding, buffer);
+    std::ofstream file(path, std::ios::binary);
+    file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    return static_cast<bool>(file);
+}
+
+/**
+ * @brief Read-only view of a binary map file mapped into memory.
+ * For the Bits encoding the cells are read straight from the mapping (no
+ * parsing or copying); Rle payloads are decoded once into an owned BitMap.
+ * Move-only; the mapping is released on destruction.
+ */
+class MappedMapFile {
+public:
+    MappedMapFile() = default;
+    MappedMapFile(const MappedMapFile&) = delete;
+    MappedMapFile& operator=(const MappedMapFile&) = delete;
+    MappedMapFile(MappedMapFile&& other) noexcept { *this = std::move(other); }
+    MappedMapFile& operator=(MappedMapFile&& other) noexcept {
+        if (this != &other) {
+            close();
+            data_ = other.data_;
+            size_ = other.size_;
+            header_ = other.header_;
+            words_ = other.words_;
+            decoded_ = std::move(other.decoded_);
+            if (decoded_.height > 0) words_ = decoded_.words.data();
+            other.data_ = nullptr;
+            other.size_ = 0;
+            other.words_ = nullptr;
+        }
+        return *this;
+    }
+    ~MappedMapFile() { close(); }
+
+    /**
+     * @brief Maps a file and validates its header.
+     * @param path File to open.
+     * @param verifyChecksum Also hash the payload and compare it with the header.
+     * @param error Receives a description of the problem when false is returned.
+     */
+    bool open(const std::string& path, bool verifyChecksum, std::string& error) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = path + ": " + std::strerror(errno);
+            return false;
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(MapFileHeader))) {
+            ::close(fd);
+            error = path + ": file too small";
+            return false;
+        }
+        void* mapping = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            error = path + ": " + std::strerror(errno);
+            return false;
+        }
+        data_ = static_cast<const unsigned char*>(mapping);
+        size_ = static_cast<std::size_t>(info.st_size);
+        std::memcpy(&header_, data_, sizeof(header_));
+
+        if (std::memcmp(header_.magic, "PCGM", 4) != 0 || header_.version != kMapFileVersion) {
+            error = path + ": not a version " + std::to_string(kMapFileVersion) + " map file";
+            close();
+            return false;
+        }
+        const unsigned char* payload = data_ + sizeof(MapFileHeader);
+        std::size_t wordsPerRow = (static_cast<std::size_t>(header_.width) + 63) / 64;
+        std::size_t bitsBytes = wordsPerRow * header_.height * sizeof(std::uint64_t);
+        bool sized = header_.payloadBytes == size_ - sizeof(MapFileHeader) &&
+                     (header_.encoding != static_cast<std::uint16_t>(MapEncoding::Bits) || header_.payloadBytes == bitsBytes);
+        if (!sized || header_.width > 0x7fffffffu || header_.height > 0x7fffffffu) {
+            error = path + ": truncated or inconsistent payload";
+            close();
+            return false;
+        }
+        if (verifyChecksum && payloadChecksum(payload, header_.payloadBytes) != header_.checksum) {
+            error = path + ": checksum mismatch";
+            close();
+            return false;
+        }
+
+        if (header_.encoding == static_cast<std::uint16_t>(MapEncoding::Bits)) {
+            words_ = reinterpret_cast<const std::uint64_t*>(payload);
+        } else if (header_.encoding == static_cast<std::uint16_t>(MapEncoding::Rle)) {
+            if (!decodeRle(payload, header_.payloadBytes)) {
+                error = path + ": corrupt RLE payload";
+                close();
+                return false;
+            }
+        } else {
+            error = path + ": unknown encoding " + std::to_string(header_.encoding);
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (data_ != nullptr) ::munmap(const_cast<unsigned char*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+        words_ = nullptr;
+        decoded_ = BitMap();
+    }
+
+    bool isOpen() const { return data_ != nullptr; }
+    const MapFileHeader& header() const { return header_; }
+    int width() const { return static_cast<int>(header_.width); }
+    int height() const { return static_cast<int>(header_.height); }
+    int wordsPerRow() const { return (width() + 63) / 64; }
+
+    // Row i as BitMap words (bit j % 64 of word j / 64 is cell j).
+    const std::uint64_t* rowBits(int i) const { return words_ + static_cast<std::size_t>(i) * wordsPerRow(); }
+    bool cell(int i, int j) const { return (rowBits(i)[j >> 6] >> (j & 63)) & 1; }
+
+    // Parameters stored in the header.
+    GenParams params() const {
+        GenParams params;
+        params.width = width();
+        params.height = height();
+        params.iterations = header_.iterations;
+        params.fillProbability = header_.fillProbability;
+        params.R = header_.R;
+        params.U = header_.U;
+        params.J = header_.J;
+        params.I = header_.I;
+        params.roomSizeX = header_.roomSizeX;
+        params.roomSizeY = header_.roomSizeY;
+        params.probGenerateRoom = header_.probGenerateRoom;
+        params.probIncreaseRoom = header_.probIncreaseRoom;
+        params.probChangeDirection = header_.probChangeDirection;
+        params.probIncreaseChange = header_.probIncreaseChange;
+        return params;
+    }
+
+    // Copies the cells into a byte-per-cell Map.
+    Map toMap() const {
+        // Cada byte de bits se expande a 8 celdas de una vez con una tabla de 256 palabras
+        static const auto spread = [] {
+            std::array<std::uint64_t, 256> table{};
+            for (int b = 0; b < 256; ++b) {
+                for (int k = 0; k < 8; ++k) table[b] |= static_cast<std::uint64_t>((b >> k) & 1) << (8 * k);
+            }
+            return table;
+        }();
+        Map map(height(), width());
+        int full = width() / 8;
+        for (int i = 0; i < height(); ++i) {
+            const std::uint64_t* bits = rowBits(i);
+            Cell* row = map.row(i);
+            for (int q = 0; q < full; ++q) {
+                std::uint64_t cells = spread[(bits[q >> 3] >> (8 * (q & 7))) & 0xff];
+                std::memcpy(row + 8 * q, &cells, 8); // Celda j en el byte j % 8 (little-endian)
+            }
+            for (int j = 8 * full; j < width(); ++j) row[j] = static_cast<Cell>((bits[j >> 6] >> (j & 63)) & 1);
+        }
+        return map;
+    }
+
+private:
+    // Dos pasadas: la primera valida las rachas contra W*H antes de reservar el BitMap,
+    // la segunda rellena cada racha de unos por tramos de fila (los ceros ya vienen del constructor)
+    bool decodeRle(const unsigned char* payload, std::size_t size) {
+        std::uint64_t cells = static_cast<std::uint64_t>(width()) * height();
+        if (cells > kMaxMapFileCells) return false;
+        auto readRun = [&](std::size_t& k, std::uint64_t& run) {
+            run = 0;
+            for (int shift = 0;; shift += 7) {
+                if (k >= size || shift > 63) return false;
+                unsigned char byte = payload[k++];
+                run |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) return true;
+            }
+        };
+        std::uint64_t total = 0;
+        for (std::size_t k = 0; k < size;) {
+            std::uint64_t run = 0;
+            if (!readRun(k, run) || run > cells - total) return false;
+            total += run;
+        }
+        if (total != cells) return false;
+
+        decoded_ = BitMap(height(), width());
+        std::uint64_t position = 0;
+        int value = 0;
+        for (std::size_t k = 0; k < size; value ^= 1) {
+            std::uint64_t run = 0;
+            readRun(k, run);
+            std::uint64_t end = position + run;
+            while (value != 0 && position < end) {
+                int i = static_cast<int>(position / width());
+                int begin = static_cast<int>(position % width());
+                int stop = static_cast<int>(std::min<std::uint64_t>(end - static_cast<std::uint64_t>(i) * width(), width()));
+                setBits(decoded_.row(i), begin, stop);
+                position += stop - begin;
+            }
+            position = end;
+        }
+        words_ = decoded_.words.data();
+        return true;
+    }
+
+    // Pone en 1 las columnas [begin, end) de una fila de palabras
+    static void setBits(std::uint64_t* row, int begin, int end) {
+        if (begin >= end) return;
+        int first = begin >> 6;
+        int last = (end - 1) >> 6;
+        std::uint64_t head = ~std::uint64_t(0) << (begin & 63);
+        std::uint64_t tail = ~std::uint64_t(0) >> (63 - ((end - 1) & 63));
+        if (first == last) {
+            row[first] |= head & tail;
+            return;
+        }
+        row[first] |= head;
+        for (int w = first + 1; w < last; ++w) row[w] = ~std::uint64_t(0);
+        row[last] |= tail;
+    }
+
+    const unsigned char* data_ = nullptr;
+    std::size_t size_ = 0;
+    MapFileHeader header_{};
+    const std::uint64_t* words_ = nullptr;
+    BitMap decoded_;
+};
+
+/**
+ * @brief Canonical bytes of every input that determines a generated map.
+ * generate is a pure function of (params, seed), so two requests with the same key
+ * always produce the same map. The leading version tag must change whenever the
+ * generator output changes, so that stale on-disk caches stop matching.
+ */
+std::string generationKey(const GenParams& params, std::uint64_t seed) {
+    std::string key = "pcg-map-1";
+    auto put = [&](const auto& value) { key.append(reinterpret_cast<const char*>(&value), sizeof(value)); };
+    put(seed);
+    put(params.width);
+    put(params.height);
+    put(params.iterations);
+    put(params.fillProbability);
+    put(params.R);
+    put(params.U);
+    put(params.border);
+    put(params.agents);
+    put(params.J);
+    put(params.I);
+    put(params.roomSizeX);
+    put(params.roomSizeY);
+    put(params.roomShape);
+    put(params.probGenerateRoom);
+    put(params.probIncreaseRoom);
+    put(params.probChangeDirection);
+    put(params.probIncreaseChange);
+    put(params.levels);
+    put(params.refineIterations);
+    put(params.fillPockets);
+    key += params.rule; // Al final: es el unico campo de largo variable
+    return key;
+}
+
+/**
+ * @brief Content-addressed cache of generated maps: an in-memory LRU under a memory
+ * budget plus an optional directory of binary map files.
+ * Entries are keyed by generationKey; the directory holds <hash>.pcgm files (Bits
+ * encoding) next to <hash>.key files with the full key and the checksum of the map
+ * payload, all written through a temporary file and a rename so concurrent processes
+ * never read a partial file. A file only counts as a disk hit when its key matches
+ * exactly, so a hash collision or a file left by another key format is a miss. A disk
+ * hit is loaded into memory. Thread-safe.
+ */
+class MapCache {
+public:
+    /**
+     * @param memoryBudget Maximum bytes held in memory (the most recent map is always kept).
+     * @param directory Directory of the disk store; empty keeps the cache in memory only.
+     */
+    explicit MapCache(std::size_t memoryBudget = std::size_t(64) << 20, std::string directory = "")
+        : budget_(memoryBudget), directory_(std::move(directory)) {}
+
+    /**
+     * @brief The cached map of (params, seed), or nullptr if it is neither in memory nor on disk.
+     * The returned map stays valid even if the entry is evicted later.
+     */
+    std::shared_ptr<const Map> find(const GenParams& params, std::uint64_t seed) {
+        std::string key = generationKey(params, seed);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = index_.find(key);
+            if (it != index_.end()) {
+                lru_.splice(lru_.begin(), lru_, it->second); // Pasa a ser el mas reciente
+                ++hits_;
+                return it->second->map;
+            }
+        }
+        std::shared_ptr<const Map> loaded = load(key, params, seed);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!loaded) {
+            ++misses_;
+            return nullptr;
+        }
+        ++diskHits_;
+        remember(key, loaded);
+        return loaded;
+    }
+
+    /**
+     * @brief Stores the map generated for (params, seed) in memory and, with a directory, on disk.
+     * @return false if the disk store could not be written (the memory entry is kept).
+     */
+    bool insert(const GenParams& params, std::uint64_t seed, const Map& map) {
+        return store(generationKey(params, seed), params, seed, std::make_shared<const Map>(map));
+    }
+
+    /**
+     * @brief find, or generate with context (see GenerationContext::generate) and insert.
+     */
+    std::shared_ptr<const Map> get(const GenParams& params, std::uint64_t seed, GenerationContext& context) {
+        std::shared_ptr<const Map> map = find(params, seed);
+        if (map) return map;
+        map = std::make_shared<const Map>(context.generate(params, seed));
+        store(generationKey(params, seed), params, seed, map);
+        return map;
+    }
+
+    std::uint64_t hits() const { std::lock_guard<std::mutex> lock(mutex_); return hits_; }
+    std::uint64_t diskHits() const { std::lock_guard<std::mutex> lock(mutex_); return diskHits_; }
+    std::uint64_t misses() const { std::lock_guard<std::mutex> lock(mutex_); return misses_; }
+    std::uint64_t evictions() const { std::lock_guard<std::mutex> lock(mutex_); return evictions_; }
+    std::size_t cachedMaps() const { std::lock_guard<std::mutex> lock(mutex_); return lru_.size(); }
+    std::size_t cachedBytes() const { std::lock_guard<std::mutex> lock(mutex_); return bytes_; }
+
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const Map> map;
+    };
+
+    static std::size_t entryBytes(const Entry& entry) {
+        return sizeof(Entry) + entry.key.size() + sizeof(Map) + entry.map->cells.size();
+    }
+
+    bool store(const std::string& key, const GenParams& params, std::uint64_t seed,
+               const std::shared_ptr<const Map>& map) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            remember(key, map);
+        }
+        if (directory_.empty()) return true;
+        std::string path = pathOf(key);
+        std::string encoded;
+        encodeMapBinary(*map, params, seed, MapEncoding::Bits, encoded);
+        MapFileHeader header;
+        std::memcpy(&header, encoded.data(), sizeof(header));
+        // La clave lleva el checksum del mapa: un .key y un .pcgm de escritores distintos no se mezclan
+        std::string sidecar = key;
+        sidecar.append(reinterpret_cast<const char*>(&header.checksum), sizeof(header.checksum));
+        return writeAtomically(path, encoded) && writeAtomically(keyPathOf(path), sidecar);
+    }
+
+    // Escribe en un temporal y lo renombra, para que ningun lector vea un archivo a medias
+    static bool writeAtomically(const std::string& path, const std::string& bytes) {
+        std::ostringstream temporary;
+        temporary << path << ".tmp" << std::this_thread::get_id();
+        {
+            std::ofstream file(temporary.str(), std::ios::binary);
+            file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+            if (!file) return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(temporary.str(), path, ec);
+        return !ec;
+    }
+
+    // Inserta o refresca la entrada y desaloja desde la mas antigua; requiere mutex_
+    void remember(const std::string& key, const std::shared_ptr<const Map>& map) {
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return;
+        }
+        lru_.push_front({key, map});
+        index_[key] = lru_.begin();
+        bytes_ += entryBytes(lru_.front());
+        while (bytes_ > budget_ && lru_.size() > 1) {
+            bytes_ -= entryBytes(lru_.back());
+            index_.erase(lru_.back().key);
+            lru_.pop_back();
+            ++evictions_;
+        }
+    }
+
+    std::string pathOf(const std::string& key) const {
+        static const char digits[] = "0123456789abcdef";
+        std::uint64_t hash = payloadChecksum(reinterpret_cast<const unsigned char*>(key.data()), key.size());
+        std::string name(16, '0');
+        for (int k = 15; k >= 0; --k, hash >>= 4) name[k] = digits[hash & 15];
+        return directory_ + "/" + name + ".pcgm";
+    }
+
+    static std::string keyPathOf(const std::string& mapPath) {
+        return mapPath.substr(0, mapPath.size() - 5) + ".key";
+    }
+
+    // Lee el mapa del disco; un archivo ausente o corrupto, o cuya clave no es exactamente key, cuenta como fallo
+    std::shared_ptr<const Map> load(const std::string& key, const GenParams& params, std::uint64_t seed) const {
+        if (directory_.empty()) return nullptr;
+        std::string path = pathOf(key);
+        std::ifstream sidecar(keyPathOf(path), std::ios::binary);
+        std::string stored((std::istreambuf_iterator<char>(sidecar)), std::istreambuf_iterator<char>());
+        std::uint64_t checksum = 0;
+        if (stored.size() != key.size() + sizeof(checksum) || stored.compare(0, key.size(), key) != 0) return nullptr;
+        std::memcpy(&checksum, stored.data() + key.size(), sizeof(checksum));
+        MappedMapFile file;
+        std::string error;
+        if (!file.open(path, true, error)) return nullptr;
+        const MapFileHeader& header = file.header();
+        if (header.checksum != checksum || header.seed != seed || file.width() != params.width ||
+            file.height() != params.height) {
+            return nullptr;
+        }
+        return std::make_shared<const Map>(file.toMap());
+    }
+
+    std::size_t budget_;
+    std::string directory_;
+
+    mutable std::mutex mutex_;
+    std::list<Entry> lru_; // Del mas reciente al mas antiguo
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    std::size_t bytes_ = 0;
+    std::uint64_t hits_ = 0;
+    std::uint64_t diskHits_ = 0;
+    std::uint64_t misses_ = 0;
+    std::uint64_t evictions_ = 0;
+};
+
+/**
+ * @brief Stateless 64-bit mixer (SplitMix64 finalizer) used to derive per-cell noise and per-chunk seeds.
+ */
+inline std::uint64_t mix64(std::uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief Coordinates of a chunk of a ChunkedWorld (chunk row, chunk column).
+ */
+struct ChunkCoord {
+    std::int64_t row;
+    std::int64_t col;
+
+    bool operator==(const ChunkCoord& other) const { return row == other.row && col == other.col; }
+};
+
+struct ChunkCoordHash {
+    std::size_t operator()(const ChunkCoord& c) const {
+        return static_cast<std::size_t>(mix64(static_cast<std::uint64_t>(c.row) * 0x9e3779b97f4a7c15ULL ^
+                                              static_cast<std::uint64_t>(c.col)));
+    }
+};
+
+/**
+ * @brief Unbounded world generated on demand in square chunks, with an LRU cache under a memory budget.
+ * A chunk is a pure function of (world seed, chunk coordinates): the initial noise
+ * is hashed from the world coordinates of each cell, and every chunk has its own
+ * drunk agent (seeded from the chunk coordinates, starting at the chunk center and
+ * bouncing on the chunk edges). To generate a chunk the automaton runs on the chunk
+ * plus a halo of iterations*R cells, with the agents of every chunk that overlaps
+ * that window carving into it; the cells wrongly affected by the window border
+ * never reach the chunk, so neighboring chunks match exactly along their edges, as
+ * if the whole world had been generated at once (there is no out-of-bounds rule
+ * inside the world). GenParams::width, height and levels are ignored; the chunk size is used.
+ */
+class ChunkedWorld {
+public:
+    /**
+     * @param params Automaton and agent parameters shared by every chunk.
+     * @param worldSeed Seed of the whole world.
+     * @param chunkSize Side of a chunk in cells.
+     * @param memoryBudget Maximum bytes held by cached chunks (the most recent one is always kept).
+     */
+    ChunkedWorld(const GenParams& params, std::uint64_t worldSeed, int chunkSize = 64,
+                 std::size_t memoryBudget = std::size_t(64) << 20)
+        : params_(params), rules_(makeRuleset(params)), seed_(worldSeed), chunkSize_(chunkSize),
+          budget_(memoryBudget), halo_(std::max(0, params.iterations) * std::max(0, params.R)) {}
+
+    int chunkSize() const { return chunkSize_; }
+    int halo() const { return halo_; }
+
+    /**
+     * @brief Returns chunk (row, col), generating it if it is not cached.
+     * The returned map stays valid even if the chunk is evicted later. Thread-safe.
+     */
+    std::shared_ptr<const Map> chunk(std::int64_t row, std::int64_t col) {
+        ChunkCoord coord{row, col};
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = index_.find(coord);
+            if (it != index_.end()) {
+                lru_.splice(lru_.begin(), lru_, it->second); // Pasa a ser el mas reciente
+                ++hits_;
+                return it->second->map;
+            }
+            ++misses_;
+        }
+
+        // Generar fuera del candado; si otro hilo genero el mismo chunk se usa el suyo (son identicos)
+        auto map = std::make_shared<const Map>(generateRegion(row * chunkSize_, col * chunkSize_, chunkSize_, chunkSize_));
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(coord);
+        if (it != index_.end()) return it->second->map;
+        lru_.push_front({coord, map});
+        index_[coord] = lru_.begin();
+        bytes_ += chunkBytes(*map);
+        while (bytes_ > budget_ && lru_.size() > 1) {
+            bytes_ -= chunkBytes(*lru_.back().map);
+            index_.erase(lru_.back().coord);
+            lru_.pop_back();
+            ++evictions_;
+        }
+        return map;
+    }
+
+    // Value of world cell (i, j).
+    Cell cell(std::int64_t i, std::int64_t j) {
+        std::int64_t row = floorDiv(i, chunkSize_);
+        std::int64_t col = floorDiv(j, chunkSize_);
+        return (*chunk(row, col))(static_cast<int>(i - row * chunkSize_), static_cast<int>(j - col * chunkSize_));
+    }
+
+    /**
+     * @brief Generates the missing chunks within radius chunks of (row, col), in parallel on the pool.
+     * Meant to be called as the player moves, so the chunks around them are ready before they are read.
+     */
+    void prefetch(std::int64_t row, std::int64_t col, int radius, ThreadPool* pool = nullptr) {
+        prefetchChunks(row - radius, row + radius, col - radius, col + radius, pool);
+    }
+
+    // Generates the missing chunks covering world cells [i0, i0 + height) x [j0, j0 + width).
+    void prefetchRegion(std::int64_t i0, std::int64_t j0, int height, int width, ThreadPool* pool = nullptr) {
+        prefetchChunks(floorDiv(i0, chunkSize_), floorDiv(i0 + height - 1, chunkSize_),
+                       floorDiv(j0, chunkSize_), floorDiv(j0 + width - 1, chunkSize_), pool);
+    }
+
+    /**
+     * @brief Generates the world cells [i0, i0 + height) x [j0, j0 + width) without touching the cache.
+     * Any region gives the same cells as the chunks covering it.
+     */
+    Map generateRegion(std::int64_t i0, std::int64_t j0, int height, int width) const {
+        int H = height + 2 * halo_;
+        int W = width + 2 * halo_;
+        std::int64_t wi0 = i0 - halo_;
+        std::int64_t wj0 = j0 - halo_;
+
+        Map window(H, W, 0);
+        if (params_.fillProbability > 0.0) {
+            for (int i = 0; i < H; ++i) {
+                Cell* row = window.row(i);
+                for (int j = 0; j < W; ++j) row[j] = (noise(wi0 + i, wj0 + j) < params_.fillProbability) ? 1 : 0;
+            }
+        }
+
+        // Un agente por cada chunk que toca la ventana; sus caminos no dependen del mapa
+        struct Agent {
+            std::int64_t originRow;
+            std::int64_t originCol;
+            int x;
+            int y;
+            Pcg32 rng;
+        };
+        std::vector<Agent> agents;
+        for (std::int64_t r = floorDiv(wi0, chunkSize_); r <= floorDiv(wi0 + H - 1, chunkSize_); ++r) {
+            for (std::int64_t c = floorDiv(wj0, chunkSize_); c <= floorDiv(wj0 + W - 1, chunkSize_); ++c) {
+                std::uint64_t chunkSeed = mix64(seed_ ^ mix64(static_cast<std::uint64_t>(r) * 0x9e3779b97f4a7c15ULL ^
+                                                              static_cast<std::uint64_t>(c)));
+                agents.push_back({r * chunkSize_, c * chunkSize_, chunkSize_ / 2, chunkSize_ / 2, Pcg32(chunkSeed)});
+            }
+        }
+
+        CellularAutomaton automaton(window, rules_);
+        automaton.enableTileTracking(true);
+        Map trail(chunkSize_, chunkSize_, 0); // El agente excava aqui, en coordenadas del chunk
+        std::vector<CellPos> touched;
+        RoomStamp room(params_.roomShape, params_.roomSizeX, params_.roomSizeY);
+        for (int iteration = 0; iteration < params_.iterations; ++iteration) {
+            automaton.step();
+            Map& current = automaton.current();
+            for (Agent& agent : agents) {
+                touched.clear();
+                drunkAgentInPlace(trail, params_.J, params_.I, room,
+                                  params_.probGenerateRoom, params_.probIncreaseRoom,
+                                  params_.probChangeDirection, params_.probIncreaseChange,
+                                  agent.x, agent.y, agent.rng, &touched);
+                for (const CellPos& c : touched) {
+                    trail(c.row, c.col) = 0; // Dejar el rastro limpio para el siguiente agente
+                    std::int64_t i = agent.originRow + c.row - wi0;
+                    std::int64_t j = agent.originCol + c.col - wj0;
+                    if (i < 0 || i >= H || j < 0 || j >= W) continue;
+                    Cell& cell = current(static_cast<int>(i), static_cast<int>(j));
+                    if (cell != 1) {
+                        cell = 1;
+                        automaton.markDirty(static_cast<int>(i), static_cast<int>(j));
+                    }
+                }
+            }
+        }
+
+        // Recortar el halo
+        Map region(height, width);
+        const Map& result = automaton.current();
+        for (int i = 0; i < height; ++i) {
+            std::memcpy(region.row(i), result.row(i + halo_) + halo_, static_cast<std::size_t>(width));
+        }
+        return region;
+    }
+
+    std::size_t cachedChunks() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return lru_.size();
+    }
+
+    std::size_t cachedBytes() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return bytes_;
+    }
+
+    std::uint64_t hits() const { std::lock_guard<std::mutex> lock(mutex_); return hits_; }
+    std::uint64_t misses() const { std::lock_guard<std::mutex> lock(mutex_); return misses_; }
+    std::uint64_t evictions() const { std::lock_guard<std::mutex> lock(mutex_); return evictions_; }
+
+private:
+    struct Entry {
+        ChunkCoord coord;
+        std::shared_ptr<const Map> map;
+    };
+
+    static std::int64_t floorDiv(std::int64_t a, std::int64_t b) {
+        std::int64_t q = a / b;
+        return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+    }
+
+    // Genera los chunks que faltan en [rowBegin, rowEnd] x [colBegin, colEnd]
+    void prefetchChunks(std::int64_t rowBegin, std::int64_t rowEnd, std::int64_t colBegin, std::int64_t colEnd,
+                        ThreadPool* pool) {
+        std::vector<ChunkCoord> missing;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (std::int64_t r = rowBegin; r <= rowEnd; ++r) {
+                for (std::int64_t c = colBegin; c <= colEnd; ++c) {
+                    if (index_.find({r, c}) == index_.end()) missing.push_back({r, c});
+                }
+            }
+        }
+        auto load = [&](int k) { chunk(missing[k].row, missing[k].col); };
+        int count = static_cast<int>(missing.size());
+        if (pool != nullptr && pool->size() > 1) pool->parallelFor(count, load);
+        else for (int k = 0; k < count; ++k) load(k);
+    }
+
+    static std::size_t chunkBytes(const Map& map) { return sizeof(Map) + map.cells.size(); }
+
+    // Ruido inicial de la celda (i, j) del mundo, uniforme en [0, 1)
+    double noise(std::int64_t i, std::int64_t j) const {
+        std::uint64_t h = mix64(seed_ ^ mix64(static_cast<std::uint64_t>(i) * 0xd1b54a32d192ed03ULL ^
+                                              static_cast<std::uint64_t>(j) * 0x8cb92ba72f3d8dd7ULL));
+        return static_cast<double>(h >> 11) * 0x1.0p-53;
+    }
+
+    GenParams params_;
+    Ruleset rules_;
+    std::uint64_t seed_;
+    int chunkSize_;
+    std::size_t budget_;
+    int halo_;
+
+    mutable std::mutex mutex_;
+    std::list<Entry> lru_; // Del mas reciente al mas antiguo
+    std::unordered_map<ChunkCoord, std::list<Entry>::iterator, ChunkCoordHash> index_;
+    std::size_t bytes_ = 0;
+    std::uint64_t hits_ = 0;
+    std::uint64_t misses_ = 0;
+    std::uint64_t evictions_ = 0;
+};
+
+/**
+ * @brief Parses "--key=value" command line options into a dictionary.
+ * A bare "--flag" is stored with the value "1". Returns false on a malformed option.
+ */
+bool parseOptions(int argc, char* argv[], std::map<std::string, std::string>& options) {
+    for (int k = 0; k < argc; ++k) {
+        std::string arg = argv[k];
+        if (arg.size() < 3 || arg.compare(0, 2, "--") != 0) {
+            std::cerr << "Unexpected argument: " << arg << std::endl;
+            return false;
+        }
+        std::size_t eq = arg.find('=');
+        if (eq == std::string::npos) options[arg.substr(2)] = "1";
+        else options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    }
+    return true;
+}
+
+/**
+ * @brief Fills a GenParams from parsed options, leaving absent keys at their defaults.
+ * Recognized keys: width, height, iterations, fill, R, U, rule, border, agents, J, I, roomX, roomY,
+ * roomShape (rect|ellipse|cross), probRoom, probIncRoom, probDir, probIncDir, levels (1 .. kMaxLevels), refine,
+ * fillPockets (0/1; only for maps of at most kMaxLabeledCells cells).
+ * Throws std::invalid_argument (or std::out_of_range) on a malformed value, or on a rule or
+ * radius that makeRuleset rejects for the map size.
+ */
+void applyGenOptions(const std::map<std::string, std::string>& options, GenParams& params) {
+    auto intOpt = [&](const char* key, int& value) {
+        auto it = options.find(key);
+        if (it != options.end()) value = std::stoi(it->second);
+    };
+    auto doubleOpt = [&](const char* key, double& value) {
+        auto it = options.find(key);
+        if (it != options.end()) value = std::stod(it->second);
+    };
+    intOpt("width", params.width);
+    intOpt("height", params.height);
+    intOpt("iterations", params.iterations);
+    doubleOpt("fill", params.fillProbability);
+    intOpt("R", params.R);
+    doubleOpt("U", params.U);
+    auto rule = options.find("rule");
+    if (rule != options.end()) params.rule = (rule->second == "threshold") ? "" : rule->second;
+    auto border = options.find("border");
+    if (border != options.end() && !parseBorderMode(border->second, params.border)) {
+        throw std::invalid_argument("border");
+    }
+    intOpt("agents", params.agents);
+    intOpt("J", params.J);
+    intOpt("I", params.I);
+    intOpt("roomX", params.roomSizeX);
+    intOpt("roomY", params.roomSizeY);
+    auto shape = options.find("roomShape");
+    if (shape != options.end() && !parseRoomShape(shape->second, params.roomShape)) {
+        throw std::invalid_argument("roomShape");
+    }
+    doubleOpt("probRoom", params.probGenerateRoom);
+    doubleOpt("probIncRoom", params.probIncreaseRoom);
+    doubleOpt("probDir", params.probChangeDirection);
+    doubleOpt("probIncDir", params.probIncreaseChange);
+    intOpt("levels", params.levels);
+    intOpt("refine", params.refineIterations);
+    if (params.levels < 1 || params.levels > kMaxLevels || params.refineIterations < 0) {
+        throw std::invalid_argument("levels");
+    }
+    auto pockets = options.find("fillPockets");
+    if (pockets != options.end()) params.fillPockets = std::stoi(pockets->second) != 0;
+    if (params.fillPockets && static_cast<std::int64_t>(params.width) * params.height > kMaxLabeledCells) {
+        throw std::invalid_argument("fillPockets"); // labelComponents no etiqueta mapas tan grandes
+    }
+    makeRuleset(params); // Valida la regla y R con el tamano del mapa ya leido
+}
+
+/**
+ * @brief Batch driver: generates one map per seed in [first, last) in parallel.
+ * Runs as a Pipeline of four stages (generate, post-process with finishMap,
+ * serialize, write) with at most --queue=K maps in flight (default 2 per thread),
+ * so generation overlaps with I/O and a slow disk throttles the generators.
+ * Writes one file per map named map_<seed>.txt in the output directory, rendered with
+ * '#'/' ' glyphs (--format=digits keeps the printMap layout), or map_<seed>.pcgm
+ * in the binary format with --format=bin (bit-packed) or --format=rle.
+ *
+ * Options: --seeds=first:last --threads=N --queue=K --out=DIR --format=ascii|digits|bin|rle
+ * --backend=cpu|gpu --stats[=FILE] plus the generation keys accepted by applyGenOptions (fill
+ * defaults to 0.45 in batch mode). With --backend=gpu each map runs resident on the
+ * device (generateMapGpu), falling back to the CPU when the GPU is not available.
+ * --stats prints the merged RunStats of all maps as JSON on stderr, followed by one
+ * line per pipeline stage; with a FILE, one JSON line per map (with its seed) is also
+ * written there. --cache-dir=DIR looks every map up in a MapCache stored in DIR before
+ * generating it and stores the maps it generates (--cache-mb=N bounds its memory, default 64).
+ * @return Process exit code.
+ */
+int runBatch(int argc, char* argv[]) {
+    std::map<std::string, std::string> options;
+    if (!parseOptions(argc, argv, options)) return 1;
+
+    GenParams params;
+    params.fillProbability = 0.45;
+    std::uint64_t firstSeed = 0;
+    std::uint64_t lastSeed = 100;
+    int threads = 0;
+    std::string outDir = "maps";
+    try {
+        applyGenOptions(options, params);
+        if (options.count("seeds")) {
+            const std::string& range = options["seeds"];
+            std::size_t colon = range.find(':');
+            if (colon == std::string::npos) {
+                firstSeed = std::stoull(range);
+                lastSeed = firstSeed + 1;
+            } else {
+                firstSeed = std::stoull(range.substr(0, colon));
+                lastSeed = std::stoull(range.substr(colon + 1));
+            }
+        }
+        if (options.count("threads")) threads = std::stoi(options["threads"]);
+    } catch (const std::exception&) {
+        std::cerr << "Invalid option value" << std::endl;
+        return 1;
+    }
+    if (options.count("out")) outDir = options["out"];
+    std::string format = options.count("format") ? options["format"] : "ascii";
+    bool digits = format == "digits";
+    bool binary = format == "bin" || format == "rle";
+    MapEncoding encoding = (format == "rle") ? MapEncoding::Rle : MapEncoding::Bits;
+    if (!digits && !binary && format != "ascii") {
+        std::cerr << "Unknown format: " << format << std::endl;
+        return 1;
+    }
+    std::string backend = options.count("backend") ? options["backend"] : "cpu";
+    if (backend != "cpu" && backend != "gpu") {
+        std::cerr << "Unknown backend: " << backend << std::endl;
+        return 1;
+    }
+    bool gpu = backend == "gpu";
+    std::once_flag fallbackReported;
+
+    bool stats = options.count("stats") > 0;
+    RunStats totalStats;
+    std::ofstream statsFile;
+    if (stats && options["stats"] != "1") {
+        statsFile.open(options["stats"]);
+        if (!statsFile) {
+            std::cerr << "Cannot write " << options["stats"] << std::endl;
+            return 1;
+        }
+    }
+    if (lastSeed <= firstSeed || params.width <= 0 || params.height <= 0) {
+        std::cerr << "Nothing to generate" << std::endl;
+        return 1;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(outDir, ec);
+    if (ec) {
+        std::cerr << "Cannot create " << outDir << ": " << ec.message() << std::endl;
+        return 1;
+    }
+
+    if (threads <= 0) threads = static_cast<int>(std::thread::hardware_concurrency());
+    threads = std::max(1, threads);
+    int queueDepth = 2 * threads;
+    long long cacheMb = 64;
+    try {
+        if (options.count("queue")) queueDepth = std::stoi(options["queue"]);
+        if (options.count("cache-mb")) cacheMb = std::stoll(options["cache-mb"]);
+    } catch (const std::exception&) {
+        std::cerr << "Invalid option value" << std::endl;
+        return 1;
+    }
+    if (queueDepth <= 0 || cacheMb < 0) {
+        std::cerr << "Invalid option value" << std::endl;
+        return 1;
+    }
+    std::optional<MapCache> cache;
+    if (options.count("cache-dir")) {
+        const std::string& cacheDir = options["cache-dir"];
+        std::filesystem::create_directories(cacheDir, ec);
+        if (ec) {
+            std::cerr << "Cannot create " << cacheDir << ": " << ec.message() << std::endl;
+            return 1;
+        }
+        cache.emplace(static_cast<std::size_t>(cacheMb) << 20, cacheDir);
+    }
+
+    // Un mapa en vuelo por el pipeline; sus buffers se reutilizan para la siguiente semilla
+    struct Job {
+        std::uint64_t seed = 0;
+        bool finished = false; // El backend ya aplico finishMap (ruta GPU o cache)
+        bool cached = false;   // Leido de la cache: no hay que volver a guardarlo
+        Map map;
+        std::string bytes;
+        RunStats stats;
+    };
+    std::uint64_t count = lastSeed - firstSeed; // Sin truncar: --seeds admite rangos de 64 bits
+    std::atomic<std::uint64_t> next{0};
+    int failures = 0;
+    int cacheFailures = 0;
+
+    Pipeline<Job> pipeline(queueDepth);
+    pipeline.addStage("generate", threads, [&](Job& job) {
+        std::uint64_t k = next.fetch_add(1);
+        if (k >= count) return false;
+        job.seed = firstSeed + k;
+        job.finished = gpu;
+        job.cached = false;
+        if (stats) job.stats = RunStats{};
+        if (cache) {
+            if (std::shared_ptr<const Map> hit = cache->find(params, job.seed)) {
+                job.map = *hit;
+                job.finished = job.cached = true;
+                return true;
+            }
+        }
+        std::optional<StatsScope> scope;
+        if (stats) scope.emplace(job.stats);
+        if (gpu) {
+            std::string reason;
+            job.map = generateMapGpu(params, job.seed, &reason);
+            if (!reason.empty()) {
+                std::call_once(fallbackReported, [&] { std::cerr << "GPU backend unavailable (" << reason << "), using the CPU" << std::endl; });
+            }
+        } else {
+            thread_local GenerationContext context; // Buffers de generacion por hilo, reutilizados entre mapas
+            job.map = context.generateRaw(params, job.seed); // La copia reutiliza la capacidad de job.map
+        }
+        return true;
+    });
+    pipeline.addStage("post", threads, [&](Job& job) {
+        if (job.finished) return true;
+        thread_local std::vector<std::int32_t> labels;
+        thread_local ComponentReport report;
+        std::optional<StatsScope> scope;
+        if (stats) scope.emplace(job.stats);
+        finishMap(params, job.map, nullptr, labels, report);
+        return true;
+    });
+    pipeline.addStage("serialize", std::max(1, threads / 2), [&](Job& job) {
+        std::optional<StatsScope> scope;
+        if (stats) scope.emplace(job.stats);
+        PCG_PHASE_TIMER(printSeconds);
+        if (binary) {
+            encodeMapBinary(job.map, params, job.seed, encoding, job.bytes);
+        } else if (digits) {
+            thread_local std::ostringstream text;
+            text.str("");
+            printMap(job.map, text);
+            job.bytes = text.str();
+        } else {
+            renderMap(job.map, job.bytes, false);
+        }
+        return true;
+    });
+    // Una sola etapa de escritura: el disco no gana con mas hilos y las estadisticas no necesitan lock
+    pipeline.addStage("write", 1, [&](Job& job) {
+        {
+            std::optional<StatsScope> scope;
+            if (stats) scope.emplace(job.stats);
+            PCG_PHASE_TIMER(printSeconds);
+            std::ofstream file(outDir + "/map_" + std::to_string(job.seed) + (binary ? ".pcgm" : ".txt"), std::ios::binary);
+            file.write(job.bytes.data(), static_cast<std::streamsize>(job.bytes.size()));
+            if (!file) ++failures;
+        }
+        if (cache && !job.cached && !cache->insert(params, job.seed, job.map)) ++cacheFailures;
+        if (stats) {
+            totalStats.merge(job.stats);
+            if (statsFile.is_open()) {
+                statsFile << "{\"seed\":" << job.seed << "," << job.stats.toJson().substr(1) << "\n";
+            }
+        }
+        return true;
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    pipeline.run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Generated " << count << " maps of " << params.width << "x" << params.height
+              << " with " << threads << " threads in " << seconds << " s ("
+              << (seconds > 0 ? count / seconds : 0.0) << " maps/s)" << std::endl;
+    if (cache) {
+        std::cout << "Cache: " << cache->hits() + cache->diskHits() << " hits (" << cache->diskHits()
+                  << " from disk), " << cache->misses() << " misses" << std::endl;
+        if (cacheFailures > 0) std::cerr << cacheFailures << " maps could not be stored in the cache" << std::endl;
+    }
+    if (stats) {
+        std::cerr << totalStats.toJson() << std::endl;
+        for (const auto& stage : pipeline.stats()) {
+            std::cerr << "{\"stage\":\"" << stage.name << "\",\"threads\":" << stage.threads
+                      << ",\"items\":" << stage.items << ",\"busy_seconds\":" << stage.busySeconds
+                      << ",\"wait_seconds\":" << stage.waitSeconds << "}" << std::endl;
+        }
+    }
+    if (failures > 0) {
+        std::cerr << failures << " maps could not be written to " << outDir << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints the header and the cells of binary map files.
+ * Usage: PCG show FILE... [--no-verify] [--quiet] (--quiet prints only the header line).
+ * @return Process exit code.
+ */
+int runShow(int argc, char* argv[]) {
+    std::vector<std::string> files;
+    bool verify = true;
+    bool quiet = false;
+    for (int k = 0; k < argc; ++k) {
+        std::string arg = argv[k];
+        if (arg == "--no-verify") verify = false;
+        else if (arg == "--quiet") quiet = true;
+        else files.push_back(arg);
+    }
+    if (files.empty()) {
+        std::cerr << "Usage: PCG show FILE... [--no-verify] [--quiet]" << std::endl;
+        return 1;
+    }
+
+    std::string buffer;
+    int status = 0;
+    for (const std::string& path : files) {
+        MappedMapFile file;
+        std::string error;
+        if (!file.open(path, verify, error)) {
+            std::cerr << error << std::endl;
+            status = 1;
+            continue;
+        }
+        const MapFileHeader& h = file.header();
+        std::cout << path << ": " << h.width << "x" << h.height << " seed=" << h.seed
+                  << " iterations=" << h.iterations << " R=" << h.R << " U=" << h.U
+                  << " J=" << h.J << " I=" << h.I << " room=" << h.roomSizeX << "x" << h.roomSizeY
+                  << " encoding=" << (h.encoding == static_cast<std::uint16_t>(MapEncoding::Rle) ? "rle" : "bits")
+                  << " payload=" << h.payloadBytes << "B" << std::endl;
+        if (!quiet) printMapFast(file.toMap(), buffer);
+    }
+    return status;
+}
+
+/**
+ * @brief Renders a viewport of a ChunkedWorld, streaming the chunks it covers through the cache.
+ * Options: --seed=N --chunk=SIDE --budget-mb=MB --row=I --col=J --view-width=W --view-height=H
+ * --threads=N plus the generation keys accepted by applyGenOptions (width and height are
+ * ignored, fill defaults to 0.45). Cache statistics are printed to stderr.
+ * @return Process exit code.
+ */
+int runWorld(int argc, char* argv[]) {
+    std::map<std::string, std::string> options;
+    if (!parseOptions(argc, argv, options)) return 1;
+
+    GenParams params;
+    params.fillProbability = 0.45;
+    std::uint64_t seed = 0;
+    int chunkSize = 64;
+    double budgetMb = 64.0;
+    std::int64_t row0 = 0;
+    std::int64_t col0 = 0;
+    int viewWidth = 120;
+    int viewHeight = 60;
+    int threads = 0;
+    try {
+        // El mapa de cada trozo es el trozo: R se valida contra su lado
+        if (options.count("chunk")) chunkSize = std::stoi(options["chunk"]);
+        std::map<std::string, std::string> genOptions = options;
+        genOptions.erase("width");
+        genOptions.erase("height");
+        params.width = params.height = chunkSize;
+        applyGenOptions(genOptions, params);
+        if (options.count("seed")) seed = std::stoull(options["seed"]);
+        if (options.count("budget-mb")) budgetMb = std::stod(options["budget-mb"]);
+        if (options.count("row")) row0 = std::stoll(options["row"]);
+        if (options.count("col")) col0 = std::stoll(options["col"]);
+        if (options.count("view-width")) viewWidth = std::stoi(options["view-width"]);
+        if (options.count("view-height")) viewHeight = std::stoi(options["view-height"]);
+        if (options.count("threads")) threads = std::stoi(options["threads"]);
+    } catch (const std::exception&) {
+        std::cerr << "Invalid option value" << std::endl;
+        return 1;
+    }
+    if (chunkSize <= 0 || viewWidth <= 0 || viewHeight <= 0 || budgetMb < 0.0) {
+        std::cerr << "Nothing to generate" << std::endl;
+        return 1;
+    }
+
+    ChunkedWorld world(params, seed, chunkSize, static_cast<std::size_t>(budgetMb * 1024.0 * 1024.0));
+    ThreadPool pool(threads);
+    auto start = std::chrono::steady_clock::now();
+
+    world.prefetchRegion(row0, col0, viewHeight, viewWidth, &pool); // Cargar en paralelo los chunks de la vista
+
+    Map view(viewHeight, viewWidth);
+    for (int i = 0; i < viewHeight; ++i) {
+        Cell* out = view.row(i);
+        for (int j = 0; j < viewWidth; ++j) out[j] = world.cell(row0 + i, col0 + j);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::string buffer;
+    printMapFast(view, buffer);
+    std::cerr << "chunks=" << world.misses() << " cached=" << world.cachedChunks()
+              << " cachedBytes=" << world.cachedBytes() << " evictions=" << world.evictions()
+              << " halo=" << world.halo() << " in " << seconds << " s" << std::endl;
+    return 0;
+}
+
+/**
+ * @brief Parses a comma separated list of numbers ("1,2,4").
+ */
+template <typename T>
+std::vector<T> parseList(const std::string& text) {
+    std::vector<T> values;
+    std::size_t begin = 0;
+    while (begin <= text.size()) {
+        std::size_t end = text.find(',', begin);
+        if (end == std::string::npos) end = text.size();
+        if (end > begin) values.push_back(static_cast<T>(std::stod(text.substr(begin, end - begin))));
+        begin = end + 1;
+    }
+    return values;
+}
+
+/**
+ * @brief Writes benchmark records as JSON lines or CSV to out.
+ * In CSV a header is printed before the first row and again, after an empty line,
+ * whenever a record has other columns than the previous one, so every kind of
+ * record (ca, agent, generate, cache...) forms its own table with aligned columns.
+ * An empty value is an empty CSV cell and null in JSON.
+ */
+class BenchWriter {
+public:
+    using Record = std::vector<std::pair<std::string, std::string>>;
+
+    explicit BenchWriter(bool csv, std::ostream& out = std::cout) : csv_(csv), out_(out) {}
+
+    void write(const Record& record) {
+        if (csv_) {
+            bool sameColumns = headerDone_ && columns_.size() == record.size();
+            for (std::size_t k = 0; sameColumns && k < record.size(); ++k) sameColumns = columns_[k] == record[k].first;
+            if (!sameColumns) {
+                if (headerDone_) out_ << "\n";
+                columns_.clear();
+                for (std::size_t k = 0; k < record.size(); ++k) {
+                    out_ << (k ? "," : "") << record[k].first;
+                    columns_.push_back(record[k].first);
+                }
+                out_ << "\n";
+                headerDone_ = true;
+            }
+            for (std::size_t k = 0; k < record.size(); ++k) out_ << (k ? "," : "") << record[k].second;
+            out_ << "\n";
+        } else {
+            out_ << "{";
+            for (std::size_t k = 0; k < record.size(); ++k) {
+                const std::string& value = record[k].second;
+                bool number = !value.empty() && value.find_first_not_of("0123456789.-+eE") == std::string::npos;
+                out_ << (k ? "," : "") << "\"" << record[k].first << "\":"
+                          << (value.empty() ? "null" : number ? value : "\"" + value + "\"");
+            }
+            out_ << "}\n";
+        }
+        out_.flush();
+    }
+
+private:
+    bool csv_;
+    std::ostream& out_;
+    bool headerDone_ = false;
+    std::vector<std::string> columns_; // Columnas del ultimo encabezado CSV
+};
+
+/**
+ * @brief Result of timing a kernel: repetitions, seconds per repetition and heap allocations per repetition.
+ */
+struct BenchTiming {
+    int iterations = 0;
+    double secondsPerIteration = 0.0;
+    double allocationsPerIteration = -1.0; // -1 sin PCG_BENCH_ALLOC (no se cuentan)
+};
+
+// Valor de la columna allocs_per_iter: vacio (null en JSON) cuando el build no cuenta reservas
+std::string allocsField(const BenchTiming& timing) {
+    return timing.allocationsPerIteration < 0 ? std::string() : std::to_string(timing.allocationsPerIteration);
+}
 
 /**
- * @brief Prints the map (matrix) to the console.
- * @param map The map to print.
+ * @brief Runs body once as warm-up, then repeatedly until minSeconds have elapsed.
  */
-void printMap(const Map& map) {
-    std::cout << "--- Current Map ---" << std::endl;
-    for (const auto& row : map) {
-        for (int cell : row) {
-            // Adapt this to represent your cells meaningfully (e.g., ' ' for empty, '#' for occupied).
-            std::cout << cell << " ";
+BenchTiming timeKernel(double minSeconds, const std::function<void()>& body) {
+    body();
+    BenchTiming timing;
+#if defined(PCG_BENCH_ALLOC)
+    std::uint64_t allocsBefore = gAllocationCount.load();
+#endif
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    do {
+        body();
+        ++timing.iterations;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < minSeconds);
+    timing.secondsPerIteration = elapsed / timing.iterations;
+#if defined(PCG_BENCH_ALLOC)
+    timing.allocationsPerIteration = static_cast<double>(gAllocationCount.load() - allocsBefore) / timing.iterations;
+#endif
+    return timing;
+}
+
+const char* countModeName(CountMode mode) {
+    switch (mode) {
+        case CountMode::Window: return "window";
+        case CountMode::Integral: return "integral";
+        case CountMode::Vector: return "vector";
+        default: return "auto";
+    }
+}
+
+/**
+ * @brief Benchmark driver for the cellular automata and drunk agent kernels.
+ * Prints one record per configuration with ns per cell (or per agent step),
+ * throughput and heap allocations per iteration.
+ *
+ * Options:
+ *   --sizes=64,256,1024,4096,8192  square map sizes for the CA
+ *   --radii=1,2,3,4,5,6,7,8        CA radii
+ *   --thresholds=0.5               CA thresholds U
+ *   --rule=B5678/S45678            birth/survival rule measured instead of the thresholds
+ *   --modes=window,integral,vector,bitmap
+ *   --threads=1                    threads used by the CA step
+ *   --agent-size=1024 --J=10,100,1000 --I=10,100 --rooms=3,9,33
+ *   --room-shapes=rect             room stamps (rect,ellipse,cross)
+ *   --agents=1,2,4,8               concurrent agents (drunkAgentsConcurrent on all cores)
+ *   --gen-sizes=64,256,1024        whole maps (batch defaults) with generateMap and a GenerationContext,
+ *                                  and MapCache hits from memory and from disk
+ *   --gen-levels=1,3               resolution levels of the whole maps (see ResolutionPyramid)
+ *   --min-time=0.25                seconds measured per configuration
+ *   --window-budget=2e9            skip window runs above this many neighbor reads
+ *   --format=json|csv --skip-ca --skip-agent --skip-generate
+ * @return Process exit code.
+ */
+int runBench(int argc, char* argv[]) {
+    std::map<std::string, std::string> options;
+    if (!parseOptions(argc, argv, options)) return 1;
+    auto opt = [&](const char* key, const char* fallback) {
+        auto it = options.find(key);
+        return it != options.end() ? it->second : std::string(fallback);
+    };
+
+    std::vector<int> sizes, radii, walks, steps, rooms, agentCounts, genSizes, genLevels;
+    std::vector<double> thresholds;
+    int threads = 1;
+    int agentSize = 1024;
+    double minSeconds = 0.25;
+    double windowBudget = 2e9;
+    try {
+        sizes = parseList<int>(opt("sizes", "64,256,1024,4096,8192"));
+        radii = parseList<int>(opt("radii", "1,2,3,4,5,6,7,8"));
+        thresholds = parseList<double>(opt("thresholds", "0.5"));
+        walks = parseList<int>(opt("J", "10,100,1000"));
+        steps = parseList<int>(opt("I", "10,100"));
+        rooms = parseList<int>(opt("rooms", "3,9,33"));
+        agentCounts = parseList<int>(opt("agents", "1"));
+        genSizes = parseList<int>(opt("gen-sizes", "64,256,1024"));
+        genLevels = parseList<int>(opt("gen-levels", "1"));
+        threads = std::stoi(opt("threads", "1"));
+        agentSize = std::stoi(opt("agent-size", "1024"));
+        minSeconds = std::stod(opt("min-time", "0.25"));
+        windowBudget = std::stod(opt("window-budget", "2e9"));
+    } catch (const std::exception&) {
+        std::cerr << "Invalid option value" << std::endl;
+        return 1;
+    }
+    for (int levels : genLevels) {
+        if (levels < 1 || levels > kMaxLevels) {
+            std::cerr << "--gen-levels must be between 1 and " << kMaxLevels << std::endl;
+            return 1;
+        }
+    }
+    std::string ruleText = opt("rule", "");
+    if (!ruleText.empty()) {
+        Ruleset parsed;
+        if (!Ruleset::parse(ruleText, 1, parsed)) {
+            std::cerr << "Invalid rule: " << ruleText << std::endl;
+            return 1;
+        }
+        thresholds = {0.0}; // Una sola pasada por radio, con la regla en lugar del umbral
+    }
+    std::vector<RoomShape> roomShapes;
+    {
+        std::string text = opt("room-shapes", "rect");
+        std::size_t begin = 0;
+        while (begin <= text.size()) {
+            std::size_t end = text.find(',', begin);
+            if (end == std::string::npos) end = text.size();
+            RoomShape shape;
+            if (end > begin && !parseRoomShape(text.substr(begin, end - begin), shape)) {
+                std::cerr << "Unknown room shape: " << text.substr(begin, end - begin) << std::endl;
+                return 1;
+            }
+            if (end > begin) roomShapes.push_back(shape);
+            begin = end + 1;
+        }
+    }
+    std::string modes = "," + opt("modes", "window,integral,vector,bitmap") + ",";
+    auto wants = [&](const char* name) { return modes.find(std::string(",") + name + ",") != std::string::npos; };
+
+    BenchWriter writer(opt("format", "json") == "csv");
+    std::unique_ptr<ThreadPool> pool;
+    if (threads > 1) pool = std::make_unique<ThreadPool>(threads);
+
+    if (!options.count("skip-ca")) {
+        for (int size : sizes) {
+            Map src(size, size);
+            Pcg32 rng(static_cast<std::uint64_t>(size));
+            for (int i = 0; i < size; ++i) {
+                for (int j = 0; j < size; ++j) src(i, j) = (rng.nextDouble() < 0.45) ? 1 : 0;
+            }
+            Map dst(size, size);
+            BitMap bitSrc = toBitMap(src);
+            BitMap bitDst(size, size);
+            double cells = static_cast<double>(size) * size;
+
+            for (int R : radii) {
+                double reads = cells * (2 * R + 1) * (2 * R + 1);
+                for (double U : thresholds) {
+                    Ruleset rules = Ruleset::threshold(R, U);
+                    if (!ruleText.empty()) Ruleset::parse(ruleText, R, rules);
+                    std::string uField = ruleText.empty() ? std::to_string(U) : ""; // Vacio: la regla no usa U
+                    for (CountMode mode : {CountMode::Window, CountMode::Integral, CountMode::Vector}) {
+                        if (!wants(countModeName(mode))) continue;
+                        if (mode == CountMode::Window && reads > windowBudget) continue;
+                        CAScratch scratch;
+                        BenchTiming t = timeKernel(minSeconds, [&] {
+                            cellularAutomataStep(src, dst, rules, mode, scratch, pool.get());
+                        });
+                        writer.write({{"kernel", "ca"}, {"mode", countModeName(mode)},
+                                      {"isa", mode == CountMode::Vector ? vectorIsaName(vectorKernels().isa) : "scalar"},
+                                      {"threads", std::to_string(threads)},
+                                      {"width", std::to_string(size)}, {"height", std::to_string(size)},
+                                      {"R", std::to_string(R)}, {"U", uField}, {"rule", rules.name()},
+                                      {"iterations", std::to_string(t.iterations)},
+                                      {"ns_per_cell", std::to_string(t.secondsPerIteration * 1e9 / cells)},
+                                      {"cells_per_second", std::to_string(cells / t.secondsPerIteration)},
+                                      {"allocs_per_iter", allocsField(t)}});
+                    }
+                    // El kernel de bits solo implementa el umbral
+                    if (wants("bitmap") && R <= kBitMaxRadius && ruleText.empty()) {
+                        BenchTiming t = timeKernel(minSeconds, [&] { cellularAutomataStep(bitSrc, bitDst, R, U); });
+                        writer.write({{"kernel", "ca"}, {"mode", "bitmap"}, {"isa", "scalar"}, {"threads", "1"},
+                                      {"width", std::to_string(size)}, {"height", std::to_string(size)},
+                                      {"R", std::to_string(R)}, {"U", uField}, {"rule", rules.name()},
+                                      {"iterations", std::to_string(t.iterations)},
+                                      {"ns_per_cell", std::to_string(t.secondsPerIteration * 1e9 / cells)},
+                                      {"cells_per_second", std::to_string(cells / t.secondsPerIteration)},
+                                      {"allocs_per_iter", allocsField(t)}});
+                    }
+                }
+            }
+        }
+    }
+
+    if (!options.count("skip-generate")) {
+        for (int size : genSizes) {
+            GenParams gen;
+            gen.fillProbability = 0.45;
+            gen.width = size;
+            gen.height = size;
+            for (int levels : genLevels) {
+                gen.levels = levels;
+                for (bool reuse : {false, true}) {
+                    GenerationContext context;
+                    std::uint64_t seed = 0;
+                    BenchTiming t = timeKernel(minSeconds, [&] {
+                        if (reuse) context.generate(gen, seed++);
+                        else generateMap(gen, seed++);
+                    });
+                    writer.write({{"kernel", "generate"}, {"mode", reuse ? "context" : "map"},
+                                  {"width", std::to_string(size)}, {"height", std::to_string(size)},
+                                  {"levels", std::to_string(levels)}, {"iterations", std::to_string(t.iterations)},
+                                  {"us_per_map", std::to_string(t.secondsPerIteration * 1e6)},
+                                  {"maps_per_second", std::to_string(1.0 / t.secondsPerIteration)},
+                                  {"allocs_per_iter", allocsField(t)}});
+                }
+            }
+            gen.levels = 1;
+
+            // Aciertos de MapCache: en memoria, y del disco con un presupuesto nulo y dos semillas alternadas
+            // Directorio propio (pid + sufijo aleatorio): create_directory falla si ya existe,
+            // asi que nunca se reutiliza ni se borra un directorio ajeno
+            std::error_code ec;
+            std::filesystem::path cacheDir;
+            bool created = false;
+            std::filesystem::path tempDir = std::filesystem::temp_directory_path(ec);
+            std::mt19937_64 suffix(std::random_device{}());
+            for (int attempt = 0; !ec && !created && attempt < 16; ++attempt) {
+                cacheDir = tempDir / ("pcg-bench-cache-" + std::to_string(getpid()) + "-" +
+                                      std::to_string(suffix() & 0xffffffu));
+                created = std::filesystem::create_directory(cacheDir, ec);
+                if (!created && std::filesystem::exists(cacheDir)) ec.clear(); // Nombre ocupado: otro sufijo
+            }
+            for (bool disk : {false, true}) {
+                if (disk && !created) break;
+                MapCache cache(disk ? 0 : std::size_t(64) << 20, disk ? cacheDir.string() : "");
+                GenerationContext context;
+                cache.get(gen, 0, context);
+                cache.get(gen, 1, context);
+                std::uint64_t seed = 0;
+                BenchTiming t = timeKernel(minSeconds, [&] { cache.find(gen, seed++ & 1); });
+                writer.write({{"kernel", "generate"}, {"mode", disk ? "cache-disk" : "cache-memory"},
+                              {"width", std::to_string(size)}, {"height", std::to_string(size)},
+                              {"levels", "1"}, {"iterations", std::to_string(t.iterations)},
+                              {"us_per_map", std::to_string(t.secondsPerIteration * 1e6)},
+                              {"maps_per_second", std::to_string(1.0 / t.secondsPerIteration)},
+                              {"allocs_per_iter", allocsField(t)}});
+            }
+            if (created) std::filesystem::remove_all(cacheDir, ec);
+        }
+    }
+
+    if (!options.count("skip-agent")) {
+        Map base(agentSize, agentSize);
+        Map work = base;
+        GenParams defaults;
+        std::unique_ptr<ThreadPool> agentPool;
+        for (int count : agentCounts) {
+            if (count > 1 && !agentPool) agentPool = std::make_unique<ThreadPool>();
+        }
+        std::vector<DrunkAgentState> agents;
+        std::vector<CellPos> touched;
+        std::vector<std::vector<CellPos>> trails;
+        for (int J : walks) {
+            for (int I : steps) {
+                for (int room : rooms) {
+                    for (RoomShape shape : roomShapes) {
+                        RoomStamp stamp(shape, room, room); // Fuera del kernel: se construye una vez por habitacion
+                        for (int count : agentCounts) {
+                            if (count < 1) continue;
+                            Pcg32 rng(1);
+                            std::vector<DrunkAgentState> initial = makeDrunkAgents(count, agentSize, agentSize, 1);
+                            // Con las listas de celdas cambiadas, como GenerationContext y ChunkedWorld
+                            BenchTiming t = timeKernel(minSeconds, [&] {
+                                std::copy(base.cells.begin(), base.cells.end(), work.cells.begin());
+                                if (count == 1) {
+                                    int agentX = agentSize / 2;
+                                    int agentY = agentSize / 2;
+                                    touched.clear();
+                                    drunkAgentInPlace(work, J, I, stamp, defaults.probGenerateRoom,
+                                                      defaults.probIncreaseRoom, defaults.probChangeDirection,
+                                                      defaults.probIncreaseChange, agentX, agentY, rng, &touched);
+                                    return;
+                                }
+                                agents.assign(initial.begin(), initial.end());
+                                drunkAgentsConcurrent(work, agents, J, I, stamp, defaults.probGenerateRoom,
+                                                      defaults.probIncreaseRoom, defaults.probChangeDirection,
+                                                      defaults.probIncreaseChange, agentPool.get(), &trails);
+                            });
+                            double agentSteps = static_cast<double>(J) * I * count;
+                            int agentThreads = (count > 1) ? std::min(count, agentPool->size()) : 1;
+                            writer.write({{"kernel", "agent"}, {"width", std::to_string(agentSize)},
+                                          {"height", std::to_string(agentSize)}, {"agents", std::to_string(count)},
+                                          {"threads", std::to_string(agentThreads)},
+                                          {"J", std::to_string(J)}, {"I", std::to_string(I)}, {"room", std::to_string(room)},
+                                          {"room_shape", roomShapeName(shape)}, {"iterations", std::to_string(t.iterations)},
+                                          {"ns_per_step", std::to_string(t.secondsPerIteration * 1e9 / agentSteps)},
+                                          {"steps_per_second", std::to_string(agentSteps / t.secondsPerIteration)},
+                                          {"allocs_per_iter", allocsField(t)}});
+                        }
+                    }
+                }
+            }
         }
-        std::cout << std::endl;
     }
-    std::cout << "-------------------" << std::endl;
+    return 0;
 }
 
 /**
- * @brief Function to implement the Cellular Automata logic.
- * It should take a map and return the updated map after one iteration.
- * @param currentMap The map in its current state.
- * @param W Width of the map.
- * @param H Height of the map.
- * @param R Radius of the neighbor window (e.g., 1 for 3x3, 2 for 5x5).
- * @param U Threshold to decide if the current cell becomes 1 or 0.
- * @return The map after applying the cellular automata rules.
+ * @brief The original cellularAutomata, kept verbatim as the golden reference of verify.
+ * Walks the full window of every cell over a nested vector; the new state is first
+ * stored in bit 1 and then moved to bit 0, and positions outside the map count as 1.
  */
-Map cellularAutomata(Map currentMap, int W, int H, int R, double U) {
+NestedMap referenceCellularAutomata(NestedMap currentMap, int W, int H, int R, double U) {
     // Primera pasada: calcular el nuevo estado y guardarlo en el bit 1
     for (int i = 0; i < H; ++i) {
         for (int j = 0; j < W; ++j) {
@@ -70,105 +4999,855 @@ Map cellularAutomata(Map currentMap, int W, int H, int R, double U) {
 }
 
 /**
- * @brief Function to implement the Drunk Agent logic.
- * It should take a map and parameters controlling the agent's behavior,
- * then return the updated map after the agent performs its actions.
- *
- * @param currentMap The map in its current state.
- * @param W Width of the map.
- * @param H Height of the map.
- * @param J The number of times the agent "walks" (initiates a path).
- * @param I The number of steps the agent takes per "walk".
- * @param roomSizeX Max width of rooms the agent can generate.
- * @param roomSizeY Max height of rooms the agent can generate.
- * @param probGenerateRoom Probability (0.0 to 1.0) of generating a room at each step.
- * @param probIncreaseRoom If no room is generated, this value increases probGenerateRoom.
- * @param probChangeDirection Probability (0.0 to 1.0) of changing direction at each step.
- * @param probIncreaseChange If direction is not changed, this value increases probChangeDirection.
- * @param agentX Current X position of the agent (updated by reference).
- * @param agentY Current Y position of the agent (updated by reference).
- * @return The map after the agent's movements and actions.
+ * @brief Naive reference for the other border modes: the same full-window walk and ratio
+ * test as referenceCellularAutomata, but a position outside the map reads 0 (Empty) or
+ * the cell borderSource maps it to on each axis (Wrap, Mirror) instead of 1.
  */
+NestedMap referenceBorderedAutomata(const NestedMap& currentMap, int W, int H, int R, double U, BorderMode border) {
+    NestedMap newMap(H, std::vector<int>(W, 0));
+    int total = (2 * R + 1) * (2 * R + 1);
+    for (int i = 0; i < H; ++i) {
+        for (int j = 0; j < W; ++j) {
+            int count = 0;
+            for (int dx = -R; dx <= R; ++dx) {
+                for (int dy = -R; dy <= R; ++dy) {
+                    int ni = i + dx;
+                    int nj = j + dy;
+                    bool inside = ni >= 0 && ni < H && nj >= 0 && nj < W;
+                    if (inside) count += currentMap[ni][nj] & 1;
+                    else if (border == BorderMode::Solid) count += 1;
+                    else if (border != BorderMode::Empty) {
+                        count += currentMap[borderSource(ni, H, border)][borderSource(nj, W, border)] & 1;
+                    }
+                }
+            }
+            double ratio = static_cast<double>(count) / total;
+            newMap[i][j] = (ratio >= U) ? 1 : 0;
+        }
+    }
+    return newMap;
+}
 
-Map drunkAgent(const Map& currentMap, int W, int H, int J, int I, int roomSizeX, int roomSizeY,
-               double probGenerateRoom, double probIncreaseRoom,
-               double probChangeDirection, double probIncreaseChange,
-               int& agentX, int& agentY) {
-    Map newMap = currentMap; // The new map is a copy of the current one
+/**
+ * @brief One differential case of verify: an initial map, a threshold rule, a border mode,
+ * and the cells carved after each step (carves[s] is applied after step s, as the agent does).
+ */
+struct VerifyCase {
+    Map initial;
+    int R = 1;
+    double U = 0.5;
+    BorderMode border = BorderMode::Solid;
+    std::vector<std::vector<CellPos>> carves;
+};
 
-    // Inicialización del generador de números aleatorios
-    std::mt19937 rng(std::chrono::steady_clock::now().time_since_epoch().count());
-    std::uniform_real_distribution<double> chance(0.0, 1.0); // Para decisiones probabilísticas
-    std::uniform_int_distribution<int> dirDist(0, 3); // Para escoger direcciones aleatorias
+// Runs a case through one backend and returns the final map.
+using VerifyBackendFn = std::function<Map(const VerifyCase&)>;
 
-    int dx = 0, dy = 1; // Dirección inicial: hacia la derecha
+/**
+ * @brief A CA backend under verify; allBorders marks the ones that implement every BorderMode
+ * (the others only run the Solid cases).
+ */
+struct VerifyBackend {
+    std::string name;
+    VerifyBackendFn run;
+    bool allBorders = false;
+};
 
-    for (int j = 0; j < J; ++j) {
-        
-        for (int i = 0; i < I; ++i) {
-            // Marcar la posicion actual del agente en el mapa
-            if (agentX >= 0 && agentX < H && agentY >= 0 && agentY < W)
-                newMap[agentX][agentY] = 1;
+/**
+ * @brief Every CA backend of this build as a VerifyBackend, each running the steps of a case
+ * on its own data structures. The reference (referenceCellularAutomata, or
+ * referenceBorderedAutomata for the other border modes) comes first.
+ * GPU backends are listed only when a device is available.
+ */
+std::vector<VerifyBackend> verifyBackends(ThreadPool& pool) {
+    std::vector<VerifyBackend> backends;
+    backends.push_back({"reference", [](const VerifyCase& c) {
+        NestedMap map = toNested(c.initial);
+        int W = c.initial.width;
+        int H = c.initial.height;
+        for (const std::vector<CellPos>& carve : c.carves) {
+            if (c.border == BorderMode::Solid) map = referenceCellularAutomata(map, W, H, c.R, c.U);
+            else map = referenceBorderedAutomata(map, W, H, c.R, c.U, c.border);
+            for (const CellPos& p : carve) map[p.row][p.col] = 1;
+        }
+        return fromNested(map);
+    }, true});
 
-            // Calcular nueva posicion
-            int newX = agentX + dx;
-            int newY = agentY + dy;
+    // Backends de paso suelto: src -> dst y luego excavar en dst
+    auto stepper = [](std::function<void(const Map&, Map&, const Ruleset&, CAScratch&)> step) {
+        return [step](const VerifyCase& c) {
+            Ruleset rules = Ruleset::threshold(c.R, c.U);
+            Map src = c.initial;
+            Map dst(c.initial.height, c.initial.width);
+            CAScratch scratch;
+            for (const std::vector<CellPos>& carve : c.carves) {
+                step(src, dst, rules, scratch);
+                for (const CellPos& p : carve) dst(p.row, p.col) = 1;
+                std::swap(src, dst);
+            }
+            return src;
+        };
+    };
+    backends.push_back({"window", stepper([](const Map& s, Map& d, const Ruleset& r, CAScratch& k) {
+        cellularAutomataStep(s, d, r, CountMode::Window, k);
+    })});
+    backends.push_back({"integral", stepper([](const Map& s, Map& d, const Ruleset& r, CAScratch& k) {
+        cellularAutomataStep(s, d, r, CountMode::Integral, k);
+    })});
+    std::vector<VectorIsa> isas = {VectorIsa::Scalar};
+    if (detectVectorIsa() != VectorIsa::Scalar) isas.push_back(detectVectorIsa());
+    for (VectorIsa isa : isas) {
+        VectorKernels kernels = vectorKernelsFor(isa);
+        backends.push_back({std::string("vector-") + vectorIsaName(isa),
+                            stepper([kernels](const Map& s, Map& d, const Ruleset& r, CAScratch& k) {
+            if (r.total() > kVectorMaxTotal) cellularAutomataStep(s, d, r, CountMode::Integral, k);
+            else vectorStep(s, d, r, 0, s.height, 0, s.width, k.band(0), kernels);
+        })});
+    }
+    backends.push_back({"threads", stepper([&pool](const Map& s, Map& d, const Ruleset& r, CAScratch& k) {
+        cellularAutomataStep(s, d, r, CountMode::Auto, k, &pool);
+    })});
+    backends.push_back({"padded", [&pool](const VerifyCase& c) {
+        Ruleset rules = Ruleset::threshold(c.R, c.U);
+        Map src = withPadding(c.initial, c.R);
+        Map dst(c.initial.height, c.initial.width, 0, c.R);
+        CAScratch scratch;
+        for (const std::vector<CellPos>& carve : c.carves) {
+            paddedAutomataStep(src, dst, rules, c.border, scratch, &pool);
+            for (const CellPos& p : carve) dst(p.row, p.col) = 1;
+            std::swap(src, dst);
+        }
+        return src;
+    }, true});
 
-            // Si la nueva posicion es valida, mover al agente
-            if (newX >= 0 && newX < H && newY >= 0 && newY < W) {
-                agentX = newX;
-                agentY = newY;
-            } else {
-                // Si se choca con el borde del mapa, cambiar dirección aleatoriamente
-                int dir = dirDist(rng);
-                dx = (dir == 0) ? -1 : (dir == 1) ? 1 : 0;
-                dy = (dir == 2) ? -1 : (dir == 3) ? 1 : 0;
-                continue; // Saltar al siguiente paso sin intentar moverse mas
+    backends.push_back({"bitmap", [](const VerifyCase& c) {
+        BitMap src = toBitMap(c.initial);
+        BitMap dst(c.initial.height, c.initial.width);
+        for (const std::vector<CellPos>& carve : c.carves) {
+            cellularAutomataStep(src, dst, c.R, c.U);
+            for (const CellPos& p : carve) dst.set(p.row, p.col, true);
+            std::swap(src, dst);
+        }
+        return toMap(src);
+    }});
+    for (bool threaded : {false, true}) {
+        backends.push_back({threaded ? "automaton-threads" : "automaton", [&pool, threaded](const VerifyCase& c) {
+            CellularAutomaton automaton(c.initial, Ruleset::threshold(c.R, c.U), CountMode::Auto,
+                                        threaded ? &pool : nullptr, c.border);
+            automaton.enableTileTracking(true);
+            for (const std::vector<CellPos>& carve : c.carves) {
+                automaton.step();
+                for (const CellPos& p : carve) {
+                    automaton.current()(p.row, p.col) = 1;
+                    automaton.markDirty(p.row, p.col);
+                }
             }
+            return automaton.current();
+        }, true});
+    }
+    backends.push_back({"incremental", [](const VerifyCase& c) {
+        IncrementalAutomaton automaton(c.initial, Ruleset::threshold(c.R, c.U));
+        for (const std::vector<CellPos>& carve : c.carves) {
+            automaton.step();
+            for (const CellPos& p : carve) automaton.current()(p.row, p.col) = 1;
+            automaton.markChanged(carve);
+        }
+        return automaton.current();
+    }});
 
-            // Cambiar direccion con cierta probabilidad
-            if (chance(rng) < probChangeDirection) {
-                int dir = dirDist(rng);
-                dx = (dir == 0) ? -1 : (dir == 1) ? 1 : 0;
-                dy = (dir == 2) ? -1 : (dir == 3) ? 1 : 0;
-                probChangeDirection = 0.2; // Reiniciar probabilidad de cambio
+    // Grillas residentes: mismo ciclo que generateResident
+    auto resident = [](auto makeGrid) {
+        return [makeGrid](const VerifyCase& c) {
+            auto grid = makeGrid();
+            std::string error;
+            Map out;
+            if (!grid->init(c.initial, Ruleset::threshold(c.R, c.U), error)) return out;
+            for (const std::vector<CellPos>& carve : c.carves) {
+                if (!grid->step(error) || !grid->carve(carve, error)) return Map();
+            }
+            if (!grid->download(out, error)) return Map();
+            return out;
+        };
+    };
+    backends.push_back({"resident-cpu", resident([] { return std::make_unique<CpuGrid>(); })});
+#if defined(PCG_CUDA)
+    if (gpuBackendAvailable()) backends.push_back({"gpu", resident([] { return std::make_unique<CudaGrid>(); })});
+#endif
+    return backends;
+}
+
+/**
+ * @brief Random carves of verify: steps lists of up to maxCount - 1 cells of an H x W map.
+ */
+std::vector<std::vector<CellPos>> randomCarves(Pcg32& rng, int H, int W, int steps, int maxCount) {
+    std::vector<std::vector<CellPos>> carves(steps);
+    for (std::vector<CellPos>& carve : carves) {
+        int count = static_cast<int>(rng.nextBelow(static_cast<std::uint32_t>(maxCount)));
+        for (int q = 0; q < count; ++q) {
+            carve.push_back({static_cast<int>(rng.nextBelow(static_cast<std::uint32_t>(H))),
+                             static_cast<int>(rng.nextBelow(static_cast<std::uint32_t>(W)))});
+        }
+    }
+    return carves;
+}
+
+/**
+ * @brief Differential test of every CA backend against the original cellularAutomata.
+ * Runs --cases=N random cases (default 300, --seed=S): maps of 1 to --max-size cells
+ * per side (default 80) filled at a random density, radii 0 to
+ * --max-radius (default 8), thresholds drawn uniformly or exactly on a count boundary
+ * k / (2R+1)^2, --steps steps each (default 3) with random cells carved after every
+ * step, so the dirty-tile and incremental paths see edits. Half the cases use the Solid
+ * border and the rest Empty, Wrap or Mirror, which only the backends that implement
+ * every BorderMode run. Every backend must match the reference cell for cell. Then each
+ * backend runs a --bench-size square map (default 256, 0 skips) for the same steps at
+ * --bench-radius (default 2), with random cells carved between the steps as in the cases,
+ * and one record per backend is written (--format=json|csv, as bench) with its cases,
+ * mismatches, ns per cell per step and speedup over the reference. Prints the first
+ * mismatching case of every backend to stderr.
+ * @return 0 if every backend matched, 1 otherwise.
+ */
+int runVerify(int argc, char* argv[]) {
+    std::map<std::string, std::string> options;
+    if (!parseOptions(argc, argv, options)) return 1;
+    auto opt = [&](const char* key, const char* fallback) {
+        auto it = options.find(key);
+        return it != options.end() ? it->second : std::string(fallback);
+    };
+    int cases = 300;
+    std::uint64_t seed = 0;
+    int maxSize = 80;
+    int maxRadius = 8;
+    int steps = 3;
+    int benchSize = 256;
+    int benchRadius = 2;
+    double minSeconds = 0.2;
+    try {
+        cases = std::stoi(opt("cases", "300"));
+        seed = std::stoull(opt("seed", "0"));
+        maxSize = std::stoi(opt("max-size", "80"));
+        maxRadius = std::stoi(opt("max-radius", "8"));
+        steps = std::stoi(opt("steps", "3"));
+        benchSize = std::stoi(opt("bench-size", "256"));
+        benchRadius = std::stoi(opt("bench-radius", "2"));
+        minSeconds = std::stod(opt("min-time", "0.2"));
+    } catch (const std::exception&) {
+        std::cerr << "Invalid option value" << std::endl;
+        return 1;
+    }
+    if (cases < 0 || maxSize < 1 || maxRadius < 0 || steps < 1 || benchSize < 0 || benchRadius < 0) {
+        std::cerr << "Invalid option value" << std::endl;
+        return 1;
+    }
+
+    ThreadPool pool(4); // Fijo: las bandas deben ejercitarse aunque la maquina tenga un solo nucleo
+    std::vector<VerifyBackend> backends = verifyBackends(pool);
+    std::vector<int> mismatches(backends.size(), 0);
+    std::vector<int> checked(backends.size(), 0);
+
+    Pcg32 rng(seed);
+    for (int k = 0; k < cases; ++k) {
+        VerifyCase c;
+        int H = 1 + static_cast<int>(rng.nextBelow(static_cast<std::uint32_t>(maxSize)));
+        int W = 1 + static_cast<int>(rng.nextBelow(static_cast<std::uint32_t>(maxSize)));
+        c.R = static_cast<int>(rng.nextBelow(static_cast<std::uint32_t>(maxRadius + 1)));
+        int total = (2 * c.R + 1) * (2 * c.R + 1);
+        if (rng.nextBelow(2) == 0) c.U = static_cast<double>(rng.nextBelow(static_cast<std::uint32_t>(total + 1))) / total;
+        else c.U = rng.nextDouble() * 1.1 - 0.05;
+        // La mitad de los casos con el borde solido original, el resto repartido entre los otros modos
+        if (rng.nextBelow(2) != 0) {
+            const BorderMode others[] = {BorderMode::Empty, BorderMode::Wrap, BorderMode::Mirror};
+            c.border = others[rng.nextBelow(3)];
+        }
+        double fill = rng.nextDouble();
+        c.initial = Map(H, W);
+        for (int i = 0; i < H; ++i) {
+            for (int j = 0; j < W; ++j) c.initial(i, j) = rng.nextDouble() < fill ? 1 : 0;
+        }
+        c.carves = randomCarves(rng, H, W, steps, W * H / 16 + 2);
+
+        Map expected = backends[0].run(c);
+        ++checked[0];
+        for (std::size_t b = 1; b < backends.size(); ++b) {
+            if (c.border != BorderMode::Solid && !backends[b].allBorders) continue;
+            ++checked[b];
+            Map got = backends[b].run(c);
+            if (got == expected) continue;
+            if (mismatches[b]++ > 0) continue;
+            int row = -1, col = -1;
+            for (int i = 0; i < H && row < 0; ++i) {
+                for (int j = 0; j < W; ++j) {
+                    if (got.height != H || got.width != W || got(i, j) != expected(i, j)) {
+                        row = i;
+                        col = j;
+                        break;
+                    }
+                }
+            }
+            std::cerr << backends[b].name << " differs from the reference on case " << k << " (" << W << "x" << H
+                      << " R=" << c.R << " U=" << c.U << " border=" << borderModeName(c.border) << "), first at cell ("
+                      << row << ", " << col << ")" << std::endl;
+        }
+    }
+
+    BenchWriter writer(opt("format", "json") == "csv");
+    VerifyCase bench;
+    if (benchSize > 0) {
+        bench.R = benchRadius;
+        bench.initial = Map(benchSize, benchSize);
+        Pcg32 fillRng(seed ^ 0x5eed);
+        for (Cell& cell : bench.initial.cells) cell = fillRng.nextDouble() < 0.45 ? 1 : 0;
+        // Se excava entre pasos como en los casos: sin ediciones los backends incrementales no hacen nada
+        bench.carves = randomCarves(fillRng, benchSize, benchSize, steps, benchSize * benchSize / 16 + 2);
+    }
+    double referenceSeconds = 0.0;
+    double cellSteps = static_cast<double>(benchSize) * benchSize * steps;
+    for (std::size_t b = 0; b < backends.size(); ++b) {
+        BenchWriter::Record fields = {
+            {"backend", backends[b].name}, {"cases", std::to_string(checked[b])},
+            {"mismatches", std::to_string(mismatches[b])}};
+        if (benchSize > 0) {
+            BenchTiming t = timeKernel(minSeconds, [&] { backends[b].run(bench); });
+            if (b == 0) referenceSeconds = t.secondsPerIteration;
+            fields.push_back({"size", std::to_string(benchSize)});
+            fields.push_back({"R", std::to_string(benchRadius)});
+            fields.push_back({"ns_per_cell", std::to_string(t.secondsPerIteration * 1e9 / cellSteps)});
+            fields.push_back({"speedup", std::to_string(referenceSeconds / t.secondsPerIteration)});
+        }
+        writer.write(fields);
+    }
+
+    int failed = 0;
+    for (int m : mismatches) failed += (m > 0);
+    std::cerr << "Verified " << backends.size() - 1 << " backends on " << cases << " cases: "
+              << (failed == 0 ? "all match the reference" : std::to_string(failed) + " differ from the reference") << std::endl;
+    return failed == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Parameter sweep: generates maps for every combination of a grid of GenParams
+ * (or for random samples of it) in parallel and writes their quality metrics.
+ * Any generation key of applyGenOptions may list several values, comma-separated (rule
+ * values are separated by '|', since rules may contain commas): --R=1,2 --U=0.4,0.5,0.6
+ * --J=5,10 --rule=threshold|B5678/S45678. The grid is their cartesian product; with
+ * --random=N, N combinations are drawn instead, each numeric key uniformly within the
+ * range of its values and every other key among its values (--sample-seed=S).
+ * Every combination generates the maps of --seeds=first:last (default 0:4, the same seeds
+ * for all), on a worker that reuses one GenerationContext. Width and height default to
+ * 64 and fill to 0.45. Other options: --threads=N --out=FILE (default stdout) --format=csv|json.
+ * Each record holds the parameters, the mean MapMetrics of its maps and the mean
+ * generation time (us_per_map, without the metrics).
+ * @return Process exit code.
+ */
+int runSweep(int argc, char* argv[]) {
+    std::map<std::string, std::string> options;
+    if (!parseOptions(argc, argv, options)) return 1;
+
+    const std::vector<std::string> intKeys = {"width", "height", "iterations", "R", "agents", "J", "I", "roomX", "roomY",
+                                              "levels", "refine"};
+    const std::vector<std::string> doubleKeys = {"fill", "U", "probRoom", "probIncRoom", "probDir", "probIncDir"};
+    const std::vector<std::string> otherKeys = {"rule", "border", "roomShape", "fillPockets"};
+    auto isIn = [](const std::vector<std::string>& keys, const std::string& key) {
+        return std::find(keys.begin(), keys.end(), key) != keys.end();
+    };
+
+    // Ejes del barrido: claves de generacion presentes en las opciones, con sus valores
+    std::map<std::string, std::string> base = {{"width", "64"}, {"height", "64"}, {"fill", "0.45"}};
+    std::vector<std::pair<std::string, std::vector<std::string>>> axes;
+    for (const auto& option : options) {
+        const std::string& key = option.first;
+        if (!isIn(intKeys, key) && !isIn(doubleKeys, key) && !isIn(otherKeys, key)) continue;
+        char separator = (key == "rule") ? '|' : ',';
+        std::vector<std::string> values;
+        std::size_t begin = 0;
+        while (begin <= option.second.size()) {
+            std::size_t end = option.second.find(separator, begin);
+            if (end == std::string::npos) end = option.second.size();
+            if (end > begin) values.push_back(option.second.substr(begin, end - begin));
+            begin = end + 1;
+        }
+        if (values.size() == 1) base[key] = values[0];
+        else if (values.size() > 1) axes.push_back({key, values});
+    }
+
+    std::uint64_t firstSeed = 0;
+    std::uint64_t lastSeed = 4;
+    int threads = 0;
+    long long samples = 0;
+    std::uint64_t sampleSeed = 0;
+    std::vector<GenParams> combinations;
+    try {
+        if (options.count("seeds")) {
+            const std::string& range = options["seeds"];
+            std::size_t colon = range.find(':');
+            if (colon == std::string::npos) {
+                firstSeed = std::stoull(range);
+                lastSeed = firstSeed + 1;
             } else {
-                probChangeDirection += probIncreaseChange; // Incrementar probabilidad de cambio
+                firstSeed = std::stoull(range.substr(0, colon));
+                lastSeed = std::stoull(range.substr(colon + 1));
             }
         }
+        if (options.count("threads")) threads = std::stoi(options["threads"]);
+        if (options.count("random")) samples = std::stoll(options["random"]);
+        if (options.count("sample-seed")) sampleSeed = std::stoull(options["sample-seed"]);
 
-        // Intentar generar una habitación con cierta probabilidad
-        if (chance(rng) < probGenerateRoom) {
-            int halfX = roomSizeX / 2;
-            int halfY = roomSizeY / 2;
-            // Dibujar una habitación centrada en la posicion del agente
-            for (int dxRoom = -halfX; dxRoom <= halfX; ++dxRoom) {
-                for (int dyRoom = -halfY; dyRoom <= halfY; ++dyRoom) {
-                    int rx = agentX + dxRoom;
-                    int ry = agentY + dyRoom;
-                    // Verificar que este dentro del mapa
-                    if (rx >= 0 && rx < H && ry >= 0 && ry < W) {
-                        newMap[rx][ry] = 1;
+        auto build = [&](const std::map<std::string, std::string>& values) {
+            GenParams params;
+            applyGenOptions(values, params);
+            // Las metricas etiquetan cada mapa (labelComponents)
+            if (static_cast<std::int64_t>(params.width) * params.height > kMaxLabeledCells) {
+                throw std::invalid_argument("width");
+            }
+            combinations.push_back(params);
+        };
+        if (samples > 0) {
+            Pcg32 rng(sampleSeed);
+            for (long long n = 0; n < samples; ++n) {
+                std::map<std::string, std::string> values = base;
+                for (const auto& axis : axes) {
+                    const std::vector<std::string>& list = axis.second;
+                    bool isInt = isIn(intKeys, axis.first);
+                    if (!isInt && !isIn(doubleKeys, axis.first)) {
+                        values[axis.first] = list[rng.nextBelow(static_cast<std::uint32_t>(list.size()))];
+                        continue;
+                    }
+                    std::vector<double> numbers;
+                    for (const std::string& value : list) numbers.push_back(std::stod(value));
+                    double lo = *std::min_element(numbers.begin(), numbers.end());
+                    double hi = *std::max_element(numbers.begin(), numbers.end());
+                    if (isInt) {
+                        int span = static_cast<int>(hi) - static_cast<int>(lo) + 1;
+                        values[axis.first] = std::to_string(static_cast<int>(lo) + static_cast<int>(rng.nextBelow(span)));
+                    } else {
+                        values[axis.first] = std::to_string(lo + (hi - lo) * rng.nextDouble());
                     }
                 }
+                build(values);
             }
-            probGenerateRoom = 0.1; // Reiniciar probabilidad de generar habitacion
         } else {
-            probGenerateRoom += probIncreaseRoom; // Incrementar probabilidad
+            // Producto cartesiano: indice de la combinacion en base mixta sobre los ejes
+            std::size_t total = 1;
+            for (const auto& axis : axes) total *= axis.second.size();
+            for (std::size_t index = 0; index < total; ++index) {
+                std::map<std::string, std::string> values = base;
+                std::size_t rest = index;
+                for (auto axis = axes.rbegin(); axis != axes.rend(); ++axis) {
+                    values[axis->first] = axis->second[rest % axis->second.size()];
+                    rest /= axis->second.size();
+                }
+                build(values);
+            }
         }
+    } catch (const std::exception&) {
+        std::cerr << "Invalid option value" << std::endl;
+        return 1;
+    }
+    if (lastSeed <= firstSeed) {
+        std::cerr << "Nothing to generate" << std::endl;
+        return 1;
     }
 
-    return newMap; // Devolver el nuevo mapa generado
+    std::ofstream file;
+    if (options.count("out")) {
+        file.open(options["out"]);
+        if (!file) {
+            std::cerr << "Cannot write " << options["out"] << std::endl;
+            return 1;
+        }
+    }
+    BenchWriter writer(!options.count("format") || options["format"] != "json",
+                       file.is_open() ? static_cast<std::ostream&>(file) : std::cout);
+
+    struct SweepResult {
+        MapMetrics metrics;
+        double components = 0.0; // Media de las regiones por mapa
+        double usPerMap = 0.0;
+    };
+    std::vector<SweepResult> results(combinations.size());
+    std::uint64_t maps = lastSeed - firstSeed;
+    ThreadPool pool(threads);
+    auto start = std::chrono::steady_clock::now();
+    pool.parallelFor(static_cast<int>(combinations.size()), [&](int k) {
+        thread_local GenerationContext context; // Un contexto por hilo para todas sus combinaciones
+        thread_local std::vector<std::int32_t> labels;
+        thread_local ComponentReport report;
+        const GenParams& params = combinations[k];
+        SweepResult& result = results[k];
+        double seconds = 0.0;
+        for (std::uint64_t seed = firstSeed; seed < lastSeed; ++seed) {
+            auto t0 = std::chrono::steady_clock::now();
+            const Map& map = context.generate(params, seed);
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            MapMetrics m = measureMap(map, labels, report);
+            result.metrics.openRatio += m.openRatio / maps;
+            result.components += static_cast<double>(m.components) / maps;
+            result.metrics.largestRatio += m.largestRatio / maps;
+            result.metrics.corridorMean += m.corridorMean / maps;
+        }
+        result.usPerMap = seconds * 1e6 / maps;
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (std::size_t k = 0; k < combinations.size(); ++k) {
+        const GenParams& p = combinations[k];
+        const SweepResult& r = results[k];
+        writer.write({{"width", std::to_string(p.width)}, {"height", std::to_string(p.height)},
+                      {"iterations", std::to_string(p.iterations)}, {"fill", std::to_string(p.fillProbability)},
+                      {"R", std::to_string(p.R)}, {"U", std::to_string(p.U)},
+                      {"rule", p.rule.empty() ? "threshold" : p.rule}, {"border", borderModeName(p.border)},
+                      {"agents", std::to_string(p.agents)}, {"J", std::to_string(p.J)}, {"I", std::to_string(p.I)},
+                      {"roomX", std::to_string(p.roomSizeX)}, {"roomY", std::to_string(p.roomSizeY)},
+                      {"roomShape", roomShapeName(p.roomShape)},
+                      {"probRoom", std::to_string(p.probGenerateRoom)}, {"probIncRoom", std::to_string(p.probIncreaseRoom)},
+                      {"probDir", std::to_string(p.probChangeDirection)}, {"probIncDir", std::to_string(p.probIncreaseChange)},
+                      {"levels", std::to_string(p.levels)}, {"refine", std::to_string(p.refineIterations)},
+                      {"fillPockets", p.fillPockets ? "1" : "0"}, {"maps", std::to_string(maps)},
+                      {"open_ratio", std::to_string(r.metrics.openRatio)}, {"components", std::to_string(r.components)},
+                      {"largest_ratio", std::to_string(r.metrics.largestRatio)},
+                      {"corridor_mean", std::to_string(r.metrics.corridorMean)},
+                      {"us_per_map", std::to_string(r.usPerMap)}});
+    }
+    std::cerr << "Swept " << combinations.size() << " combinations x " << maps << " maps with " << pool.size()
+              << " threads in " << seconds << " s" << std::endl;
+    return 0;
+}
+
+/**
+ * @brief Latencies of the most recent requests, for the p50/p99 metrics of the server.
+ * Keeps a fixed window of samples (the oldest are overwritten), so memory stays bounded.
+ * Thread-safe.
+ */
+class LatencyWindow {
+public:
+    explicit LatencyWindow(std::size_t capacity = 4096) : samples_(std::max<std::size_t>(1, capacity)) {}
+
+    void record(double seconds) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        samples_[next_ % samples_.size()] = seconds;
+        ++next_;
+    }
+
+    // Percentile p (0 to 1) of the window, in seconds; 0 if nothing was recorded.
+    double percentile(double p) const {
+        std::vector<double> sorted;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::size_t count = std::min<std::size_t>(next_, samples_.size());
+            sorted.assign(samples_.begin(), samples_.begin() + static_cast<std::ptrdiff_t>(count));
+        }
+        if (sorted.empty()) return 0.0;
+        std::size_t k = std::min(sorted.size() - 1, static_cast<std::size_t>(p * static_cast<double>(sorted.size())));
+        std::nth_element(sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t>(k), sorted.end());
+        return sorted[k];
+    }
+
+private:
+    std::vector<double> samples_;
+    std::size_t next_ = 0;
+    mutable std::mutex mutex_;
+};
+
+// Limites de trabajo de una peticion de serve (las habitaciones se limitan por el tamano del mapa)
+const int kServeMaxIterations = 1000;
+const int kServeMaxAgents = 1024;
+const int kServeMaxWalk = 1 << 20; // J e I
+
+/**
+ * @brief Generation service: reads requests from stdin, one per line, until EOF or "quit".
+ * A request uses the command line syntax: generation keys of applyGenOptions (fill
+ * defaults to 0.45) plus --seed=N, --format=ascii|digits|bin|rle and an optional --id=TEXT
+ * echoed in the reply, e.g. "--id=7 --seed=42 --width=64 --height=64 --format=bin".
+ * Requests wait in a bounded queue (--queue=K, default 64; reading stops while it is
+ * full) for a persistent pool of --threads workers, each with a warm GenerationContext,
+ * in front of a MapCache (--cache-mb=N, default 64, 0 disables it; --cache-dir=DIR adds
+ * the disk store). Replies may come out of order; each one is a line
+ * "ok ID BYTES" followed by exactly BYTES bytes of map, or a line "error ID MESSAGE".
+ * The line "stats" replies "stats {json}" with the requests served, errors, current and
+ * maximum queue depth, cache hits and the p50/p99 latency, from the time the request was
+ * read to the time its reply was written, over the last requests. Requests are validated
+ * before they are queued: maps above --max-cells (default 2^26), values applyGenOptions rejects
+ * and iterations, agents, J, I or room sizes beyond the kServeMax* limits get an
+ * error reply. A generation that throws (e.g. std::bad_alloc) is answered with an error too.
+ * @return Process exit code.
+ */
+int runServe(int argc, char* argv[]) {
+    std::map<std::string, std::string> options;
+    if (!parseOptions(argc, argv, options)) return 1;
+    int threads = 0;
+    int queueDepth = 64;
+    long long cacheMb = 64;
+    long long maxCells = 1LL << 26;
+    try {
+        if (options.count("threads")) threads = std::stoi(options["threads"]);
+        if (options.count("queue")) queueDepth = std::stoi(options["queue"]);
+        if (options.count("cache-mb")) cacheMb = std::stoll(options["cache-mb"]);
+        if (options.count("max-cells")) maxCells = std::stoll(options["max-cells"]);
+    } catch (const std::exception&) {
+        std::cerr << "Invalid option value" << std::endl;
+        return 1;
+    }
+    if (threads <= 0) threads = static_cast<int>(std::thread::hardware_concurrency());
+    threads = std::max(1, threads);
+    if (queueDepth <= 0 || cacheMb < 0 || maxCells <= 0) {
+        std::cerr << "Invalid option value" << std::endl;
+        return 1;
+    }
+    std::optional<MapCache> cache;
+    if (cacheMb > 0 || options.count("cache-dir")) {
+        std::string cacheDir = options.count("cache-dir") ? options["cache-dir"] : "";
+        std::error_code ec;
+        if (!cacheDir.empty()) std::filesystem::create_directories(cacheDir, ec);
+        if (ec) {
+            std::cerr << "Cannot create " << cacheDir << ": " << ec.message() << std::endl;
+            return 1;
+        }
+        cache.emplace(static_cast<std::size_t>(cacheMb) << 20, cacheDir);
+    }
+
+    struct Request {
+        std::string id;
+        GenParams params;
+        std::uint64_t seed = 0;
+        std::string format;
+        std::chrono::steady_clock::time_point received;
+    };
+    BoundedQueue<Request> queue(static_cast<std::size_t>(queueDepth));
+    std::atomic<int> depth{0};
+    std::atomic<int> maxDepth{0};
+    std::atomic<std::uint64_t> served{0};
+    std::atomic<std::uint64_t> errors{0};
+    LatencyWindow latencies;
+    std::mutex outputMutex;
+
+    // Una respuesta completa por escritura, para que los hilos no intercalen bytes
+    auto reply = [&](const std::string& header, const std::string& payload) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::string message = header + "\n";
+        message += payload;
+        writeBuffer(STDOUT_FILENO, message);
+    };
+    auto statsJson = [&] {
+        std::uint64_t hits = cache ? cache->hits() + cache->diskHits() : 0;
+        return "{\"requests\":" + std::to_string(served.load()) + ",\"errors\":" + std::to_string(errors.load()) +
+               ",\"queue_depth\":" + std::to_string(depth.load()) + ",\"max_queue_depth\":" +
+               std::to_string(maxDepth.load()) + ",\"cache_hits\":" + std::to_string(hits) +
+               ",\"p50_us\":" + std::to_string(latencies.percentile(0.50) * 1e6) +
+               ",\"p99_us\":" + std::to_string(latencies.percentile(0.99) * 1e6) + "}";
+    };
+
+    // Lee y valida la peticion antes de encolarla; devuelve el mensaje de error o ""
+    auto parseRequest = [&](const std::string& line, Request& request) -> std::string {
+        // Las opciones de la linea, con la misma sintaxis que la linea de comandos
+        std::vector<std::string> tokens;
+        std::size_t begin = 0;
+        while (begin < line.size()) {
+            std::size_t end = line.find_first_of(" \t\r", begin);
+            if (end == std::string::npos) end = line.size();
+            if (end > begin) tokens.push_back(line.substr(begin, end - begin));
+            begin = end + 1;
+        }
+        std::vector<char*> args;
+        for (std::string& token : tokens) args.push_back(&token[0]);
+        std::map<std::string, std::string> fields;
+        GenParams& params = request.params;
+        params.fillProbability = 0.45;
+        if (!parseOptions(static_cast<int>(args.size()), args.data(), fields)) return "Malformed request";
+        try {
+            // El tamano primero: applyGenOptions valida R contra el
+            if (fields.count("width")) params.width = std::stoi(fields["width"]);
+            if (fields.count("height")) params.height = std::stoi(fields["height"]);
+            if (params.width <= 0 || params.height <= 0 ||
+                static_cast<long long>(params.width) * params.height > maxCells) {
+                return "Map size out of range";
+            }
+            applyGenOptions(fields, params);
+            if (fields.count("seed")) request.seed = std::stoull(fields["seed"]);
+        } catch (const std::exception&) {
+            return "Invalid option value";
+        }
+        request.format = fields.count("format") ? fields["format"] : "ascii";
+        const std::string& format = request.format;
+        if (format != "ascii" && format != "digits" && format != "bin" && format != "rle") {
+            return "Unknown format: " + format;
+        }
+        // Limites del trabajo de una peticion: una habitacion mayor que el mapa ya lo cubre entero
+        int maxRoom = 2 * std::max(params.width, params.height) + 1;
+        if (params.iterations < 0 || params.iterations > kServeMaxIterations ||
+            params.refineIterations > kServeMaxIterations) {
+            return "Iterations out of range";
+        }
+        if (params.agents < 1 || params.agents > kServeMaxAgents || params.J < 0 || params.J > kServeMaxWalk ||
+            params.I < 0 || params.I > kServeMaxWalk || params.roomSizeX < 0 || params.roomSizeX > maxRoom ||
+            params.roomSizeY < 0 || params.roomSizeY > maxRoom) {
+            return "Agent parameters out of range";
+        }
+        return "";
+    };
+
+    auto serve = [&](const Request& request) {
+        thread_local std::optional<GenerationContext> context; // Arena caliente del trabajador
+        thread_local std::string payload;
+        const GenParams& params = request.params;
+        const std::string& format = request.format;
+        try {
+            if (!context) context.emplace();
+            std::shared_ptr<const Map> cached = cache ? cache->find(params, request.seed) : nullptr;
+            const Map& map = cached ? *cached : context->generate(params, request.seed);
+            if (cache && !cached) cache->insert(params, request.seed, map);
+            if (format == "bin" || format == "rle") {
+                encodeMapBinary(map, params, request.seed, format == "rle" ? MapEncoding::Rle : MapEncoding::Bits,
+                                payload);
+            } else if (format == "digits") {
+                thread_local std::ostringstream text;
+                text.str("");
+                printMap(map, text);
+                payload = text.str();
+            } else {
+                renderMap(map, payload, false);
+            }
+        } catch (const std::exception& e) {
+            // El contexto puede quedar a medias (p. ej. tras bad_alloc): el siguiente pedido lo rehace
+            context.reset();
+            payload.clear();
+            payload.shrink_to_fit();
+            errors.fetch_add(1);
+            reply("error " + request.id + " Generation failed: " + e.what(), "");
+            return;
+        }
+        reply("ok " + request.id + " " + std::to_string(payload.size()), payload);
+        served.fetch_add(1);
+        latencies.record(std::chrono::duration<double>(std::chrono::steady_clock::now() - request.received).count());
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            Request request;
+            while (queue.pop(request)) {
+                depth.fetch_sub(1);
+                serve(request);
+            }
+        });
+    }
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos) continue;
+        std::string command = line.substr(first, line.find_first_of(" \t\r", first) - first);
+        if (command == "quit") break;
+        if (command == "stats") {
+            reply("stats " + statsJson(), "");
+            continue;
+        }
+        Request request;
+        request.received = std::chrono::steady_clock::now();
+        std::size_t idStart = line.find("--id=");
+        if (idStart != std::string::npos) {
+            idStart += 5;
+            request.id = line.substr(idStart, line.find_first_of(" \t\r", idStart) - idStart);
+        } else {
+            request.id = "-";
+        }
+        std::string error = parseRequest(line, request);
+        if (!error.empty()) {
+            errors.fetch_add(1);
+            reply("error " + request.id + " " + error, "");
+            continue;
+        }
+        int now = depth.fetch_add(1) + 1;
+        int seen = maxDepth.load();
+        while (now > seen && !maxDepth.compare_exchange_weak(seen, now)) {
+        }
+        queue.push(std::move(request)); // Bloquea con la cola llena: contrapresion sobre el cliente
+    }
+    queue.close();
+    for (std::thread& worker : workers) worker.join();
+    std::cerr << statsJson() << std::endl;
+    return 0;
 }
 
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "batch") {
+        return runBatch(argc - 2, argv + 2);
+    }
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        return runBench(argc - 2, argv + 2);
+    }
+    if (argc > 1 && std::string(argv[1]) == "show") {
+        return runShow(argc - 2, argv + 2);
+    }
+    if (argc > 1 && std::string(argv[1]) == "world") {
+        return runWorld(argc - 2, argv + 2);
+    }
+    if (argc > 1 && std::string(argv[1]) == "sweep") {
+        return runSweep(argc - 2, argv + 2);
+    }
+    if (argc > 1 && std::string(argv[1]) == "serve") {
+        return runServe(argc - 2, argv + 2);
+    }
+    if (argc > 1 && std::string(argv[1]) == "verify") {
+        return runVerify(argc - 2, argv + 2);
+    }
+
+    // Options: generation keys of applyGenOptions plus --seed=N,
+    // --print=all|final|none, --format=digits|ascii, --incremental, --stats and --regions
+    std::map<std::string, std::string> options;
+    if (!parseOptions(argc - 1, argv + 1, options)) return 1;
+    GenParams params;
+    std::uint64_t seed = clockSeed();
+    try {
+        applyGenOptions(options, params);
+        if (options.count("seed")) seed = std::stoull(options["seed"]);
+    } catch (const std::exception&) {
+        std::cerr << "Invalid option value" << std::endl;
+        return 1;
+    }
+    if (params.width <= 0 || params.height <= 0) {
+        std::cerr << "Map size out of range" << std::endl;
+        return 1;
+    }
+    if (options.count("regions") && static_cast<std::int64_t>(params.width) * params.height > kMaxLabeledCells) {
+        std::cerr << "--regions supports maps of at most " << kMaxLabeledCells << " cells" << std::endl;
+        return 1;
+    }
+    PrintMode printMode = PrintMode::All;
+    if (options.count("print")) {
+        const std::string& value = options["print"];
+        if (value == "final") printMode = PrintMode::Final;
+        else if (value == "none") printMode = PrintMode::None;
+        else if (value != "all") {
+            std::cerr << "Unknown print mode: " << value << std::endl;
+            return 1;
+        }
+    }
+    std::string format = options.count("format") ? options["format"] : "digits";
+    if (format != "digits" && format != "ascii") {
+        std::cerr << "Unknown format: " << format << std::endl;
+        return 1;
+    }
+    bool ascii = format == "ascii";
+    std::string printBuffer; // Buffer de salida reutilizado entre iteraciones
+    auto show = [&](const Map& map) {
+        PCG_PHASE_TIMER(printSeconds);
+        if (ascii) printMapFast(map, printBuffer);
+        else printMap(map);
+    };
+
+    // --stats: the callback prints the run's counters as JSON on stderr when the scope ends
+    RunStats stats;
+    std::optional<StatsScope> statsScope;
+    if (options.count("stats")) {
+        statsScope.emplace(stats, [](const RunStats& finished) { std::cerr << finished.toJson() << std::endl; });
+    }
 
-int main() {
     std::cout << "--- CELLULAR AUTOMATA AND DRUNK AGENT SIMULATION ---" << std::endl;
 
     // --- Initial Map Configuration ---
-    int mapRows = 10;
-    int mapCols = 20;
-    Map myMap(mapRows, std::vector<int>(mapCols, 0)); // Map initialized with zeros
+    int mapRows = params.height;
+    int mapCols = params.width;
+    Map myMap(mapRows, mapCols, 0); // Map initialized with zeros
 
     // TODO: IMPLEMENTATION GOES HERE: Initialize the map with some pattern or initial state.
     // For example, you might set some cells to 1 for the cellular automata
@@ -178,48 +5857,81 @@ int main() {
     int drunkAgentX = mapRows / 2;
     int drunkAgentY = mapCols / 2;
     // If your agent modifies the map at start, you could do it here:
-    // myMap[drunkAgentX][drunkAgentY] = 2; // Assuming '2' represents the agent
+    // myMap(drunkAgentX, drunkAgentY) = 2; // Assuming '2' represents the agent
+
+    Pcg32 rng(seed);
+    if (params.levels > 1) {
+        ResolutionPyramid pyramid; // Estado inicial con la estructura gruesa ya asentada
+        pyramid.run(params, rng, myMap);
+    } else if (params.fillProbability > 0.0) {
+        for (int i = 0; i < mapRows; ++i) {
+            for (int j = 0; j < mapCols; ++j) myMap(i, j) = (rng.nextDouble() < params.fillProbability) ? 1 : 0;
+        }
+    }
 
-    std::cout << "\nInitial map state:" << std::endl;
-    printMap(myMap);
+    if (printMode == PrintMode::All) {
+        std::cout << "\nInitial map state:" << std::endl;
+        show(myMap);
+    }
 
     // --- Simulation Parameters ---
-    int numIterations = 5; // Number of simulation steps
+    int numIterations = params.iterations; // Number of simulation steps
 
     // Cellular Automata Parameters
-    int ca_W = mapCols;
-    int ca_H = mapRows;
-    int ca_R = 1;      // Radius of neighbor window
-    double ca_U = 0.5; // Threshold
+    int ca_R = params.R;      // Radius of neighbor window
+    double ca_U = params.U;   // Threshold
 
     // Drunk Agent Parameters
-    int da_W = mapCols;
-    int da_H = mapRows;
-    int da_J = 5;      // Number of "walks"
-    int da_I = 10;     // Steps per walk
-    int da_roomSizeX = 5;
-    int da_roomSizeY = 3;
-    double da_probGenerateRoom = 0.1;
-    double da_probIncreaseRoom = 0.05;
-    double da_probChangeDirection = 0.2;
-    double da_probIncreaseChange = 0.03;
+    int da_J = params.J;      // Number of "walks"
+    int da_I = params.I;      // Steps per walk
+    int da_roomSizeX = params.roomSizeX;
+    int da_roomSizeY = params.roomSizeY;
+    RoomStamp da_room(params.roomShape, da_roomSizeX, da_roomSizeY); // Huella precalculada de las habitaciones
+    double da_probGenerateRoom = params.probGenerateRoom;
+    double da_probIncreaseRoom = params.probIncreaseRoom;
+    double da_probChangeDirection = params.probChangeDirection;
+    double da_probIncreaseChange = params.probIncreaseChange;
 
+    // The automaton keeps two preallocated buffers and swaps them on every step;
+    // with --incremental a single buffer is updated only where cells keep changing
+    bool incremental = options.count("incremental") > 0;
+    if (incremental && params.border != BorderMode::Solid) {
+        std::cerr << "--incremental only supports --border=solid" << std::endl;
+        return 1;
+    }
+    std::optional<CellularAutomaton> automaton;
+    std::optional<IncrementalAutomaton> smoother;
+    Ruleset caRules = params.rule.empty() ? Ruleset::threshold(ca_R, ca_U) : makeRuleset(params);
+    if (incremental) smoother.emplace(myMap, caRules);
+    else automaton.emplace(myMap, caRules, CountMode::Auto, nullptr, params.border);
+    std::vector<CellPos> touched; // Celdas excavadas por el agente en la iteracion
 
     // --- Main Simulation Loop ---
     for (int iteration = 0; iteration < numIterations; ++iteration) {
-        std::cout << "\n--- Iteration " << iteration + 1 << " ---" << std::endl;
+        if (printMode == PrintMode::All) {
+            std::cout << "\n--- Iteration " << iteration + 1 << " ---" << std::endl;
+        }
 
         // TODO: IMPLEMENTATION GOES HERE: Call the Cellular Automata and/or Drunk Agent functions.
         // The order of calls will depend on how you want them to interact.
 
         // Example: First the cellular automata, then the agent
-        myMap = cellularAutomata(myMap, ca_W, ca_H, ca_R, ca_U);
-        myMap = drunkAgent(myMap, da_W, da_H, da_J, da_I, da_roomSizeX, da_roomSizeY,
-                           da_probGenerateRoom, da_probIncreaseRoom,
-                           da_probChangeDirection, da_probIncreaseChange,
-                           drunkAgentX, drunkAgentY);
+        if (!ResolutionPyramid::steps(params, iteration)) {
+            // Multirresolucion: sin paso del automata en esta iteracion, solo el agente
+        } else if (incremental) {
+            smoother->step();
+        } else {
+            automaton->step();
+        }
+        Map& current = incremental ? smoother->current() : automaton->current();
+        touched.clear();
+        drunkAgentInPlace(current, da_J, da_I, da_room,
+                          da_probGenerateRoom, da_probIncreaseRoom,
+                          da_probChangeDirection, da_probIncreaseChange,
+                          drunkAgentX, drunkAgentY, rng, &touched);
+        if (incremental) smoother->markChanged(touched);
 
-        printMap(myMap);
+        if (printMode == PrintMode::All) show(current);
 
         // You can add a delay to visualize the simulation step by step
         // #include <thread> // For std::this_thread::sleep_for
@@ -227,6 +5939,27 @@ int main() {
         // std::this_thread::sleep_for(std::chrono::milliseconds(500));
     }
 
+    Map& finalMap = incremental ? smoother->current() : automaton->current();
+    std::uint64_t filled = finishMap(params, finalMap);
+    if (printMode == PrintMode::Final || (printMode == PrintMode::All && filled > 0)) {
+        std::cout << "\nFinal map state:" << std::endl;
+        show(finalMap);
+    }
+
+    // --regions: regiones abiertas (celdas excavadas) del mapa final, de mayor a menor
+    if (options.count("regions")) {
+        ComponentReport report = labelComponents(finalMap);
+        std::vector<std::uint64_t> sizes = report.sizes;
+        std::sort(sizes.begin(), sizes.end(), std::greater<std::uint64_t>());
+        std::cout << "\nRegions: " << report.count << " (" << report.openCells << " open cells, largest "
+                  << report.largestSize() << ", " << filled << " pocket cells filled)" << std::endl;
+        std::cout << "Sizes:";
+        for (std::size_t k = 0; k < sizes.size() && k < 16; ++k) std::cout << " " << sizes[k];
+        if (sizes.size() > 16) std::cout << " ...";
+        std::cout << std::endl;
+    }
+
     std::cout << "\n--- Simulation Finished ---" << std::endl;
+    statsScope.reset();
     return 0;
 }
\ No newline at end of file